@@ -0,0 +1,136 @@
+#include "background_renderer.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace CMU462 {
+
+bool FrameSpec::operator==( const FrameSpec& f ) const {
+
+  for ( int i = 0; i < 3; ++i ) {
+    for ( int j = 0; j < 3; ++j ) {
+      if ( svg_2_screen(i,j) != f.svg_2_screen(i,j) ) return false;
+    }
+  }
+
+  return tab == f.tab && svg == f.svg && sampler == f.sampler &&
+         width == f.width && height == f.height &&
+         sample_rate == f.sample_rate && msaa == f.msaa &&
+         analytic == f.analytic && scanline == f.scanline &&
+         sample_format == f.sample_format;
+}
+
+BackgroundRenderer::BackgroundRenderer( ) : busy (false), stopping (false) {
+
+  renderer.set_binned( false );
+  thread = std::thread( &BackgroundRenderer::run, this );
+}
+
+BackgroundRenderer::~BackgroundRenderer( ) {
+
+  {
+    lock_guard<std::mutex> lock( mutex );
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void BackgroundRenderer::schedule( const FrameSpec& spec ) {
+
+  lock_guard<std::mutex> lock( mutex );
+
+  map<size_t, Frame>::iterator frame = frames.find( spec.tab );
+  if ( frame != frames.end() && frame->second.spec == spec ) return;
+  if ( busy && current == spec ) return;
+
+  for ( size_t i = 0; i < queue.size(); ++i ) {
+    if ( queue[i].tab == spec.tab ) {
+      queue[i] = spec;
+      return;
+    }
+  }
+
+  queue.push_back( spec );
+  wake.notify_one();
+}
+
+bool BackgroundRenderer::take( const FrameSpec& spec, unsigned char* pixels ) {
+
+  lock_guard<std::mutex> lock( mutex );
+
+  map<size_t, Frame>::iterator frame = frames.find( spec.tab );
+  if ( frame == frames.end() || !(frame->second.spec == spec) ) return false;
+
+  memcpy( pixels, &frame->second.pixels[0], 4 * spec.width * spec.height );
+  return true;
+}
+
+void BackgroundRenderer::clear() {
+
+  unique_lock<std::mutex> lock( mutex );
+  queue.clear();
+  done.wait( lock, [this] { return !busy; } );
+  frames.clear();
+}
+
+void BackgroundRenderer::drop( size_t tab, const BBox2D& bounds ) {
+
+  unique_lock<std::mutex> lock( mutex );
+  for ( size_t i = 0; i < queue.size(); ) {
+    if ( queue[i].tab == tab ) queue.erase( queue.begin() + i );
+    else ++i;
+  }
+  done.wait( lock, [this, tab] { return !busy || current.tab != tab; } );
+
+  map<size_t, Frame>::iterator frame = frames.find( tab );
+  if ( frame == frames.end() ) return;
+
+  const FrameSpec& spec = frame->second.spec;
+  // the frame, grown by a pixel for filtering
+  BBox2D view;
+  view.expand( Vector2D( -1, -1 ) );
+  view.expand( Vector2D( spec.width + 1.0, spec.height + 1.0 ) );
+  if ( bounds.transformed( spec.svg_2_screen ).intersects( view ) ) {
+    frames.erase( frame );
+  }
+}
+
+void BackgroundRenderer::run() {
+
+  unique_lock<std::mutex> lock( mutex );
+  while ( true ) {
+
+    wake.wait( lock, [this] { return stopping || !queue.empty(); } );
+    if ( stopping ) return;
+
+    current = queue.front();
+    queue.pop_front();
+    busy = true;
+    lock.unlock();
+
+    // the target is set before the sample rate, which clears it
+    Frame frame;
+    frame.spec = current;
+    frame.pixels.resize( 4 * current.width * current.height );
+    renderer.set_tex_sampler( current.sampler );
+    renderer.set_msaa( current.msaa );
+    renderer.set_analytic( current.analytic );
+    renderer.set_scanline( current.scanline );
+    renderer.set_sample_format( current.sample_format );
+    renderer.set_render_target( &frame.pixels[0], current.width,
+                                current.height );
+    renderer.set_sample_rate( current.sample_rate );
+    renderer.set_svg_2_screen( current.svg_2_screen );
+    renderer.draw_svg( *current.svg );
+
+    lock.lock();
+    frames[current.tab].spec = frame.spec;
+    frames[current.tab].pixels.swap( frame.pixels );
+    busy = false;
+    done.notify_all();
+  }
+}
+
+} // namespace CMU462
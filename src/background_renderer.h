@@ -0,0 +1,101 @@
+#ifndef CMU462_BACKGROUND_RENDERER_H
+#define CMU462_BACKGROUND_RENDERER_H
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "CMU462.h"
+#include "svg.h"
+#include "texture.h"
+#include "software_renderer.h"
+#include "svg_bvh.h"
+
+namespace CMU462 {
+
+/**
+ * Everything the pixels of a frame of the software renderer depend on:
+ * the document (of a tab), its view, the target size and the renderer's
+ * output settings.
+ */
+struct FrameSpec {
+  size_t tab;
+  SVG* svg;
+  Sampler2D* sampler;
+  Matrix3x3 svg_2_screen;
+  size_t width, height, sample_rate;
+  bool msaa, analytic, scanline;
+  SampleFormat sample_format;
+
+  bool operator==( const FrameSpec& f ) const;
+};
+
+/**
+ * Renders frames that are not shown yet (the views of the tabs in the
+ * background) on a thread of its own, with a software renderer of its
+ * own. A frame is described by everything its pixels depend on, and a
+ * finished frame is only handed out for an equal description, so frames
+ * whose view or renderer settings changed since are never shown. The
+ * thread renders serially, without the binned OpenMP workers, to leave
+ * the other cores to the interactive renderer. Documents are only read:
+ * their display lists must be compiled, and neither they nor their
+ * mipmaps may change while queued (clear first).
+ */
+class BackgroundRenderer {
+ public:
+
+  BackgroundRenderer( );
+
+  // stops the thread, after the frame being rendered
+  ~BackgroundRenderer( );
+
+  // Queue a frame unless an equal one is finished, queued or being
+  // rendered. It replaces a queued frame of the same tab.
+  void schedule( const FrameSpec& spec );
+
+  // Copy the finished frame equal to spec to pixels (4 * width * height
+  // bytes). Returns false if there is none.
+  bool take( const FrameSpec& spec, unsigned char* pixels );
+
+  // drop all queued and finished frames, waiting for the one being
+  // rendered
+  void clear();
+
+  // Drop the queued frames of tab and its finished frame if it overlaps
+  // bounds (in svg coordinates), waiting for it if it is being rendered.
+  // Until the next schedule nothing of tab is drawn, so it can change.
+  void drop( size_t tab, const BBox2D& bounds );
+
+ private:
+
+  struct Frame {
+    FrameSpec spec;
+    std::vector<unsigned char> pixels;
+  };
+
+  // thread main loop
+  void run();
+
+  SoftwareRendererImp renderer;
+
+  // frames to render, in order, and finished frames by tab
+  std::deque<FrameSpec> queue;
+  std::map<size_t, Frame> frames;
+
+  // the frame being rendered, valid while busy
+  FrameSpec current;
+  bool busy;
+
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::thread thread;
+
+}; // class BackgroundRenderer
+
+} // namespace CMU462
+
+#endif // CMU462_BACKGROUND_RENDERER_H
@@ -0,0 +1,159 @@
+#include "batch_renderer.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+
+#include "svg.h"
+#include "png.h"
+#include "texture.h"
+#include "viewport.h"
+#include "image_loader.h"
+#include "software_renderer.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+// extension of a path, without the dot (empty if it has none)
+static string extension( const string& path ) {
+  size_t dot = path.find_last_of( '.' );
+  size_t slash = path.find_last_of( '/' );
+  if ( dot == string::npos || (slash != string::npos && dot < slash) ) {
+    return "";
+  }
+  return path.substr( dot + 1 );
+}
+
+BatchRenderer::BatchRenderer( )
+  : width (1024), height (1024), sample_rate (1),
+    threads (max( thread::hardware_concurrency(), 1u )),
+    compression (PNG_FAST) { }
+
+int BatchRenderer::add( const string& path ) {
+
+  struct stat st;
+  if ( stat( path.c_str(), &st ) < 0 ) return -1;
+
+  if ( st.st_mode & S_IFREG ) {
+    files.push_back( path );
+    return 0;
+  }
+
+  if ( !(st.st_mode & S_IFDIR) ) return -1;
+  DIR* dir = opendir( path.c_str() );
+  if ( !dir ) return -1;
+
+  // all svg files of the directory, in name order
+  string pathname = path;
+  if ( pathname[pathname.size() - 1] != '/' ) pathname.push_back( '/' );
+  vector<string> names;
+  struct dirent* ent;
+  while ( (ent = readdir( dir )) != NULL ) {
+    string name = ent->d_name;
+    if ( extension( name ) == "svg" ) names.push_back( pathname + name );
+  }
+  closedir( dir );
+
+  sort( names.begin(), names.end() );
+  files.insert( files.end(), names.begin(), names.end() );
+  return 0;
+}
+
+string BatchRenderer::output_path( size_t i ) const {
+
+  if ( files.size() == 1 && extension( output ) == "png" ) return output;
+
+  // the input's file name with a png extension, in the output directory
+  string name = files[i].substr( files[i].find_last_of( '/' ) + 1 );
+  if ( !extension( name ).empty() ) {
+    name = name.substr( 0, name.find_last_of( '.' ) );
+  }
+  if ( output.empty() ) return name + ".png";
+  if ( output[output.size() - 1] == '/' ) return output + name + ".png";
+  return output + "/" + name + ".png";
+}
+
+bool BatchRenderer::render( size_t i, bool binned ) const {
+
+  SVG svg;
+  if ( SVGParser::load( files[i].c_str(), &svg ) < 0 ) return false;
+
+  // the view of a new tab in the viewer: the canvas with a margin,
+  // centered in the window
+  ViewportImp viewport;
+  float span = 1.2 * max( svg.width, svg.height ) / 2;
+  viewport.set_viewbox( svg.width / 2, svg.height / 2, span );
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+  Matrix3x3 svg_2_screen = norm_to_screen * viewport.get_svg_2_norm();
+
+  // the images in view, decoded up front
+  Sampler2DImp sampler;
+  ImageLoader::load_visible( svg, svg_2_screen, width, height, &sampler );
+
+  PNG png;
+  png.width = width;
+  png.height = height;
+  png.pixels.resize( 4 * width * height );
+
+  // the target is set before the sample rate, which clears it
+  SoftwareRendererImp renderer;
+  renderer.set_binned( binned );
+  renderer.set_msaa( sample_rate > 4 );
+  renderer.set_tex_sampler( &sampler );
+  renderer.set_render_target( &png.pixels[0], width, height );
+  renderer.set_sample_rate( sample_rate );
+  renderer.set_svg_2_screen( svg_2_screen );
+  renderer.draw_svg( svg );
+
+  return PNGParser::save( output_path( i ).c_str(), png, compression ) == 0;
+}
+
+int BatchRenderer::run() {
+
+  if ( files.size() > 1 || extension( output ) != "png" ) {
+    struct stat st;
+    if ( !output.empty() &&
+         (stat( output.c_str(), &st ) < 0 || !(st.st_mode & S_IFDIR)) ) {
+      cerr << "[DrawSVG] Output directory does not exist: " << output << endl;
+      return files.size();
+    }
+  }
+
+  // Files are rendered in parallel, each by a serial renderer. A single
+  // file is rendered by the binned renderer instead, which splits it
+  // into tiles rendered in parallel.
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  bool single = files.size() == 1;
+  int failed = 0;
+  #pragma omp parallel for schedule(dynamic) num_threads(threads) \
+                           if(!single) reduction(+:failed)
+  for ( int i = 0; i < (int) files.size(); ++i ) {
+
+    chrono::steady_clock::time_point t = chrono::steady_clock::now();
+    bool done = render( i, single );
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - t;
+    if ( !done ) failed++;
+
+    #pragma omp critical
+    cerr << "[DrawSVG] " << (done ? "Rendered " : "Failed to render ")
+         << files[i] << " to " << output_path( i )
+         << " (" << elapsed.count() << " ms)" << endl;
+  }
+
+  chrono::duration<double> total = chrono::steady_clock::now() - start;
+  size_t rendered = files.size() - failed;
+  cerr << "[DrawSVG] Rendered " << rendered << " of " << files.size()
+       << " files in " << total.count() << " s ("
+       << rendered / total.count() << " files/s)" << endl;
+
+  return failed;
+}
+
+} // namespace CMU462
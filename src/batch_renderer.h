@@ -0,0 +1,78 @@
+#ifndef CMU462_BATCH_RENDERER_H
+#define CMU462_BATCH_RENDERER_H
+
+#include <string>
+#include <vector>
+
+#include "CMU462.h"
+#include "png.h"
+
+namespace CMU462 {
+
+/**
+ * Renders svg files to png files without a window (drawsvg --render).
+ * Files are viewed as a new tab of the viewer would show them, and
+ * rendered concurrently, one file per thread, each with a software
+ * renderer of its own (a single file is rendered with the binned one).
+ * Sample rates above 4 use compressed MSAA storage.
+ */
+class BatchRenderer {
+ public:
+
+  BatchRenderer( );
+
+  // Add an svg file, or all svg files of a directory. Returns -1 if the
+  // path is neither.
+  int add( const std::string& path );
+
+  inline size_t file_count() const {
+    return files.size();
+  }
+
+  // Output: a png file if there is a single input file, or else a
+  // directory that gets a png for each file, named after it. Empty puts
+  // them in the working directory.
+  inline void set_output( const std::string& output ) {
+    this->output = output;
+  }
+
+  inline void set_size( size_t width, size_t height ) {
+    this->width = width;
+    this->height = height;
+  }
+
+  inline void set_sample_rate( size_t sample_rate ) {
+    this->sample_rate = sample_rate;
+  }
+
+  inline void set_compression( PNGCompression compression ) {
+    this->compression = compression;
+  }
+
+  // number of files rendered at once
+  inline void set_threads( size_t threads ) {
+    this->threads = threads;
+  }
+
+  // Render all files, reporting each file and the throughput on stderr.
+  // Returns the number of files that failed.
+  int run();
+
+ private:
+
+  // png file of the i-th input
+  std::string output_path( size_t i ) const;
+
+  // render file i to its png, false on failure
+  bool render( size_t i, bool binned ) const;
+
+  std::vector<std::string> files;
+  std::string output;
+  size_t width, height, sample_rate, threads;
+  PNGCompression compression;
+
+}; // class BatchRenderer
+
+} // namespace CMU462
+
+#endif // CMU462_BATCH_RENDERER_H
@@ -0,0 +1,13 @@
+if(DRAWSVG_BUILD_BENCHMARKS)
+
+  # Build benchmarks
+  include_directories(${CMAKE_CURRENT_SOURCE_DIR})
+
+  # triangulation of polygons with 1k to 1M vertices
+  add_executable( triangulation_bench
+      bench/triangulation_bench.cpp
+      triangulation.cpp
+  )
+  target_link_libraries( triangulation_bench CMU462 ${CMU462_LIBRARIES} )
+
+endif(DRAWSVG_BUILD_BENCHMARKS)
@@ -0,0 +1,130 @@
+// Times the triangulator on generated polygons of 1k to 1M vertices, with
+// and without holes, and checks that the triangles cover the polygon.
+//
+// usage: triangulation_bench [max vertices]
+
+#include "triangulation.h"
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using namespace CMU462;
+
+// deterministic pseudo random numbers in [0,1)
+static double next_random( unsigned& state ) {
+  state = state * 1664525u + 1013904223u;
+  return (state >> 8) / 16777216.0;
+}
+
+// radii of [i0, i1] (periodic in n) by midpoint displacement, in
+// proportion to the length of the range
+static void displace( vector<double>& r, size_t i0, size_t i1,
+                      double roughness, unsigned& state ) {
+  if ( i1 - i0 < 2 ) return;
+  size_t mid = (i0 + i1) / 2;
+  double length = (double) (i1 - i0) / r.size();
+  r[mid] = (r[i0] + r[i1 % r.size()]) / 2 +
+           roughness * length * (next_random( state ) - 0.5);
+  displace( r, i0, mid, roughness, state );
+  displace( r, mid, i1, roughness, state );
+}
+
+// star shaped polygon of n vertices around (cx, cy) with a fractal
+// outline, like a coastline
+static void add_star( vector<Vector2D>& points, size_t n, double cx,
+                      double cy, double radius, unsigned& state ) {
+  vector<double> r( n, radius );
+  displace( r, 0, n, 0.4 * radius, state );
+  for (size_t i = 0; i < n; i++) {
+    double angle = 2 * PI * i / n;
+    points.push_back( Vector2D( cx + r[i] * cos(angle),
+                                cy + r[i] * sin(angle) ) );
+  }
+}
+
+static double ring_area( const vector<Vector2D>& points, size_t start,
+                         size_t end ) {
+  double a = 0;
+  for (size_t i = start, j = end - 1; i < end; j = i++) {
+    a += points[j].x * points[i].y - points[i].x * points[j].y;
+  }
+  return fabs( a ) / 2;
+}
+
+static double triangles_area( const vector<Vector2D>& points,
+                              const vector<uint32_t>& indices ) {
+  double a = 0;
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const Vector2D& p = points[indices[i]];
+    const Vector2D& q = points[indices[i + 1]];
+    const Vector2D& r = points[indices[i + 2]];
+    a += fabs( (q.x - p.x) * (r.y - p.y) - (r.x - p.x) * (q.y - p.y) ) / 2;
+  }
+  return a;
+}
+
+static void run( const char* name, const vector<Vector2D>& points,
+                 const vector<uint32_t>& holes ) {
+
+  // polygon area, outline minus holes
+  double expected = ring_area( points, 0, holes.empty() ? points.size()
+                                                         : holes[0] );
+  for (size_t i = 0; i < holes.size(); i++) {
+    size_t end = i + 1 < holes.size() ? holes[i + 1] : points.size();
+    expected -= ring_area( points, holes[i], end );
+  }
+
+  // repeat small inputs to get measurable times
+  int runs = max( 1, (int) (100000 / points.size()) );
+  vector<uint32_t> indices;
+  bool ok = true;
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++) {
+    indices.clear();
+    ok = triangulate( points, holes, indices ) && ok;
+  }
+  chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+  double ms = chrono::duration<double, milli>(t1 - t0).count() / runs;
+
+  double error = fabs( triangles_area( points, indices ) - expected ) / expected;
+  printf( "%-8s %8zu vertices %6zu holes %9.3f ms %8.1f ns/vertex "
+          "%8zu triangles, area error %.1e%s\n",
+          name, points.size(), holes.size(), ms, ms * 1e6 / points.size(),
+          indices.size() / 3, error, ok ? "" : " (failed)" );
+}
+
+int main( int argc, char** argv ) {
+
+  size_t max_n = argc > 1 ? atol( argv[1] ) : 1000000;
+
+  for (size_t n = 1000; n <= max_n; n *= 10) {
+
+    unsigned state = 1;
+    vector<Vector2D> points;
+    vector<uint32_t> holes;
+
+    add_star( points, n, 0, 0, 2.5, state );
+    run( "star", points, holes );
+
+    // half the vertices on the outline, the rest on a grid of holes
+    points.clear();
+    add_star( points, n / 2, 0, 0, 2.5, state );
+    size_t grid = max( 1, (int) sqrt( sqrt( (double) n ) ) );
+    size_t hole_n = (n - n / 2) / (grid * grid);
+    double cell = 2.0 / grid;
+    for (size_t y = 0; y < grid; y++) {
+      for (size_t x = 0; x < grid; x++) {
+        holes.push_back( points.size() );
+        add_star( points, hole_n, -1 + (x + 0.5) * cell,
+                  -1 + (y + 0.5) * cell, 0.3 * cell, state );
+      }
+    }
+    run( "holes", points, holes );
+  }
+
+  return 0;
+}
@@ -0,0 +1,203 @@
+#include "coverage_buffer.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace CMU462 {
+
+static inline int popcount( uint64_t mask ) {
+  int n = 0;
+  for (; mask; mask &= mask - 1) n++;
+  return n;
+}
+
+// channel i of a color stored in the given format
+static inline uint32_t channel( const unsigned char* color, int i,
+                                SampleFormat format ) {
+  return format == SAMPLE_RGBA16 ? ((const uint16_t*) color)[i] : color[i];
+}
+
+// store c, the result of blending an opaque color over anything
+static inline void store( unsigned char* color, const SampleColor& c,
+                          SampleFormat format ) {
+  for (int i = 0; i < 4; i++) {
+    if (format == SAMPLE_RGBA16) {
+      ((uint16_t*) color)[i] = c.rgba[i];
+    } else {
+      color[i] = c.rgba[i];
+    }
+  }
+}
+
+void CoverageBuffer::resize( size_t width, size_t height, size_t samples,
+                             SampleFormat format, size_t tile_size,
+                             size_t budget ) {
+
+  this->width = width;
+  this->height = height;
+  this->samples = samples;
+  this->format = format;
+  this->tile_size = tile_size;
+  all = samples >= 64 ? ~0ull : (1ull << samples) - 1;
+
+  tiles_x = (width + tile_size - 1) / tile_size;
+  size_t tiles_y = (height + tile_size - 1) / tile_size;
+  entry_size = samples * sample_size(format);
+  pool_budget = budget / max(tiles_x * tiles_y, (size_t) 1);
+
+  Pixel white;
+  white.mask = 0;
+  white.expanded = -1;
+  memset(white.color, 255, sizeof(white.color));
+  pixels.assign(width * height, white);
+  pools.assign(tiles_x * tiles_y, Pool());
+}
+
+void CoverageBuffer::blend( int x, int y, uint64_t mask,
+                            const SampleColor& c, const Color& color ) {
+
+  mask &= all;
+  if (!mask || c.transparent()) return;
+
+  Pixel& p = pixel(x, y);
+  size_t size = sample_size(format);
+
+  if (p.expanded < 0) {
+
+    uint64_t m1 = p.mask, m0 = all & ~p.mask;
+    if (mask == all && c.opaque()) {
+      store(p.color[0], c, format);
+      p.mask = 0;
+      return;
+    }
+
+    // the write lines up with the existing fragments
+    if (mask == all || mask == m0 || mask == m1) {
+      if (mask & m0) blend_sample(p.color[0], c, format);
+      if (mask & m1) blend_sample(p.color[1], c, format);
+      if (p.mask && !memcmp(p.color[0], p.color[1], size)) p.mask = 0;
+      return;
+    }
+
+    // a single fragment gets split in two
+    if (!m1) {
+      memcpy(p.color[1], p.color[0], size);
+      blend_sample(p.color[1], c, format);
+      p.mask = mask;
+      return;
+    }
+
+    // an opaque write hiding one fragment entirely leaves two
+    if (c.opaque() && (mask & m1) == m1) {
+      store(p.color[1], c, format);
+      p.mask = mask;
+      return;
+    }
+    if (c.opaque() && (mask & m0) == m0) {
+      memcpy(p.color[0], p.color[1], size);
+      store(p.color[1], c, format);
+      p.mask = mask;
+      return;
+    }
+
+    // a third fragment: blend by coverage fraction if out of memory
+    if (!expand(x, y, p)) {
+      Color partial = color;
+      partial.a *= (float) popcount(mask) / samples;
+      SampleColor f = quantize(partial, format);
+      if (f.transparent()) return;
+      blend_sample(p.color[0], f, format);
+      blend_sample(p.color[1], f, format);
+      return;
+    }
+  }
+
+  // expanded pixel, collapse it again when covered by an opaque color
+  if (mask == all && c.opaque()) {
+    collapse(x, y, p);
+    store(p.color[0], c, format);
+    p.mask = 0;
+    return;
+  }
+  unsigned char* s = &pool_of(x, y).data[p.expanded * entry_size];
+  for (int k = 0; mask; k++, mask >>= 1) {
+    if (mask & 1) blend_sample(s + size * k, c, format);
+  }
+}
+
+bool CoverageBuffer::expand( int x, int y, Pixel& p ) {
+
+  Pool& pool = pool_of(x, y);
+  int32_t entry;
+  if (!pool.free.empty()) {
+    entry = pool.free.back();
+    pool.free.pop_back();
+  } else {
+    if (pool.data.size() + entry_size > pool_budget) return false;
+    entry = pool.data.size() / entry_size;
+    pool.data.resize(pool.data.size() + entry_size);
+  }
+
+  size_t size = sample_size(format);
+  unsigned char* s = &pool.data[entry * entry_size];
+  for (size_t k = 0; k < samples; k++) {
+    memcpy(s + size * k, p.color[(p.mask >> k) & 1], size);
+  }
+  p.expanded = entry;
+  return true;
+}
+
+void CoverageBuffer::collapse( int x, int y, Pixel& p ) {
+
+  pool_of(x, y).free.push_back(p.expanded);
+  p.expanded = -1;
+}
+
+void CoverageBuffer::resolve( int x, int y, unsigned char* rgba ) const {
+
+  const Pixel& p = pixels[x + y * width];
+  uint32_t sum[4] = { 0, 0, 0, 0 };
+  if (p.expanded >= 0) {
+    const Pool& pool = pools[x / tile_size + (y / tile_size) * tiles_x];
+    const unsigned char* s = &pool.data[p.expanded * entry_size];
+    size_t size = sample_size(format);
+    for (size_t k = 0; k < samples; k++) {
+      for (int i = 0; i < 4; i++) sum[i] += channel(s + size * k, i, format);
+    }
+  } else {
+    uint32_t n1 = popcount(p.mask), n0 = samples - n1;
+    for (int i = 0; i < 4; i++) {
+      sum[i] = n0 * channel(p.color[0], i, format) +
+               n1 * channel(p.color[1], i, format);
+    }
+  }
+
+  for (int i = 0; i < 4; i++) {
+    rgba[i] = resolve_channel(sum[i], samples, format);
+  }
+}
+
+void CoverageBuffer::clear( int x0, int y0, int x1, int y1 ) {
+
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      Pixel& p = pixel(x, y);
+      if (p.expanded >= 0) collapse(x, y, p);
+      p.mask = 0;
+      memset(p.color, 255, sizeof(p.color));
+    }
+  }
+}
+
+size_t CoverageBuffer::memory_usage() const {
+
+  size_t bytes = pixels.capacity() * sizeof(Pixel);
+  for (size_t i = 0; i < pools.size(); i++) {
+    bytes += pools[i].data.capacity() +
+             pools[i].free.capacity() * sizeof(int32_t);
+  }
+  return bytes;
+}
+
+} // namespace CMU462
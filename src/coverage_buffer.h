@@ -0,0 +1,92 @@
+#ifndef CMU462_COVERAGE_BUFFER_H
+#define CMU462_COVERAGE_BUFFER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "CMU462.h"
+#include "color.h"
+#include "raster_kernels.h"
+
+namespace CMU462 {
+
+// Most samples per pixel a coverage buffer can hold (8x8)
+static const size_t kMaxCoverageSamples = 64;
+
+/**
+ * Compressed MSAA storage. Each pixel keeps two colors and a coverage
+ * mask selecting which of its samples use the second color, which is
+ * enough for interiors and pixels crossed by a single edge. Pixels that
+ * end up with more fragments are expanded to full per-sample storage,
+ * taken from a pool per tile so tiles can be rasterized in parallel.
+ * Results are identical to a full sample buffer until a tile exhausts
+ * its share of the memory budget; writes that would expand further are
+ * then blended by coverage fraction instead.
+ */
+class CoverageBuffer {
+ public:
+
+  CoverageBuffer( ) : width (0), height (0), samples (0),
+    format (SAMPLE_RGBA8), tile_size (1), tiles_x (0),
+    entry_size (0), pool_budget (0), all (0) { }
+
+  // Allocate for width x height pixels of the given number of samples
+  // (at most kMaxCoverageSamples) and clear to white. Expanded pixels of
+  // each tile_size x tile_size tile may use budget / (number of tiles)
+  // bytes.
+  void resize( size_t width, size_t height, size_t samples,
+               SampleFormat format, size_t tile_size, size_t budget );
+
+  // Blend c over the samples of pixel (x,y) set in mask. color is the
+  // unquantized c, used when the pixel can not be expanded.
+  void blend( int x, int y, uint64_t mask,
+              const SampleColor& c, const Color& color );
+
+  // resolve pixel (x,y) to 8 bit RGBA
+  void resolve( int x, int y, unsigned char* rgba ) const;
+
+  // reset the pixels [x0,x1)x[y0,y1) to white
+  void clear( int x0, int y0, int x1, int y1 );
+
+  // bytes currently allocated, pixels and pools
+  size_t memory_usage() const;
+
+ private:
+
+  struct Pixel {
+    uint64_t mask;               // samples using color[1]
+    int32_t expanded;            // pool entry holding all samples, or -1
+    unsigned char color[2][8];   // in the sample format
+  };
+
+  // per-tile storage of expanded pixels
+  struct Pool {
+    std::vector<unsigned char> data;
+    std::vector<int32_t> free;
+  };
+
+  inline Pixel& pixel( int x, int y ) { return pixels[x + y * width]; }
+  inline Pool& pool_of( int x, int y ) {
+    return pools[x / tile_size + (y / tile_size) * tiles_x];
+  }
+
+  // expand pixel (x,y) to per-sample storage, false if over budget
+  bool expand( int x, int y, Pixel& p );
+
+  // return the expanded storage of pixel (x,y) to its pool
+  void collapse( int x, int y, Pixel& p );
+
+  size_t width, height, samples;
+  SampleFormat format;
+  size_t tile_size, tiles_x;
+  size_t entry_size, pool_budget;
+  uint64_t all;
+
+  std::vector<Pixel> pixels;
+  std::vector<Pool> pools;
+
+}; // class CoverageBuffer
+
+} // namespace CMU462
+
+#endif // CMU462_COVERAGE_BUFFER_H
@@ -0,0 +1,236 @@
+#include "display_list.h"
+
+#include "svg.h"
+#include "triangulation.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+static bool is_identity( const Matrix3x3& m ) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      if ( m(i, j) != (i == j ? 1 : 0) ) return false;
+    }
+  }
+  return true;
+}
+
+void DisplayList::compile( SVG& svg ) {
+
+  // a triangulated list stays so
+  bool retriangulate = triangulated;
+  clear();
+  transforms.push_back( Affine2D() );
+
+  root_count = svg.elements.size();
+  children.resize( root_count );
+  for (size_t i = 0; i < root_count; i++) {
+    uint32_t child = add( svg.elements[i], Matrix3x3::identity(), 0 );
+    children[i] = child;
+  }
+
+  compiled = true;
+  if ( retriangulate ) triangulate();
+}
+
+void DisplayList::triangulate() {
+
+  if ( triangulated ) return;
+
+  vector<uint32_t> polygons;
+  for (size_t i = 0; i < commands.size(); i++) {
+    if ( commands[i].kind == POLYGON ) polygons.push_back(i);
+  }
+  triangulate_polygons( polygons );
+  triangulated = true;
+}
+
+void DisplayList::clear() {
+
+  commands.clear();
+  transforms.clear();
+  points.clear();
+  indices.clear();
+  children.clear();
+  root_count = 0;
+  compiled = false;
+  triangulated = false;
+  unused_indices = 0;
+}
+
+uint32_t DisplayList::add( SVGElement* element, const Matrix3x3& parent,
+                           uint32_t parent_transform ) {
+
+  DisplayCommand cmd;
+  cmd.kind = element->type;
+  cmd.rule = NONZERO;
+  cmd.transform = parent_transform;
+  cmd.first = points.size();
+  cmd.count = 0;
+  cmd.tri_first = 0;
+  cmd.tri_count = 0;
+  cmd.fill = element->style.fillColor;
+  cmd.stroke = element->style.strokeColor;
+  cmd.tex = NULL;
+  cmd.element = element;
+
+  // transforms are concatenated in double precision and rounded once
+  Matrix3x3 world = parent;
+  if ( !is_identity( element->transform ) ) {
+    world = parent * element->transform;
+    cmd.transform = transforms.size();
+    transforms.push_back( Affine2D( world ) );
+  }
+
+  if ( element->type == GROUP ) {
+    // the group's command goes first, then its subtree
+    const Group* group = static_cast<const Group*>(element);
+    cmd.first = children.size();
+    cmd.count = group->elements.size();
+    children.resize( children.size() + cmd.count );
+    uint32_t index = commands.size();
+    commands.push_back( cmd );
+    for (size_t i = 0; i < group->elements.size(); i++) {
+      // add may grow children, so it is indexed afterwards
+      uint32_t child = add( group->elements[i], world, cmd.transform );
+      children[cmd.first + i] = child;
+    }
+    return index;
+  }
+
+  add_points( element, points );
+  if ( element->type == POLYGON ) {
+    cmd.rule = static_cast<const Polygon*>(element)->fillRule;
+  } else if ( element->type == IMAGE ) {
+    cmd.tex = &static_cast<Image*>(element)->tex;
+  }
+
+  cmd.count = points.size() - cmd.first;
+  commands.push_back( cmd );
+  return commands.size() - 1;
+}
+
+void DisplayList::add_points( const SVGElement* element,
+                              vector<Vector2D>& out ) {
+
+  switch ( element->type ) {
+    case POINT:
+      out.push_back( static_cast<const Point*>(element)->position );
+      break;
+    case LINE: {
+      const Line* line = static_cast<const Line*>(element);
+      out.push_back( line->from );
+      out.push_back( line->to );
+      break;
+    }
+    case POLYLINE: {
+      const Polyline* polyline = static_cast<const Polyline*>(element);
+      out.insert( out.end(), polyline->points.begin(),
+                             polyline->points.end() );
+      break;
+    }
+    case RECT: {
+      const Rect* rect = static_cast<const Rect*>(element);
+      float x = rect->position.x;
+      float y = rect->position.y;
+      float w = rect->dimension.x;
+      float h = rect->dimension.y;
+      out.push_back( Vector2D(   x   ,   y   ) );
+      out.push_back( Vector2D( x + w ,   y   ) );
+      out.push_back( Vector2D(   x   , y + h ) );
+      out.push_back( Vector2D( x + w , y + h ) );
+      break;
+    }
+    case POLYGON: {
+      const Polygon* polygon = static_cast<const Polygon*>(element);
+      out.insert( out.end(), polygon->points.begin(),
+                             polygon->points.end() );
+      break;
+    }
+    case ELLIPSE: {
+      const Ellipse* ellipse = static_cast<const Ellipse*>(element);
+      out.push_back( ellipse->center );
+      out.push_back( ellipse->radius );
+      break;
+    }
+    case IMAGE: {
+      const Image* image = static_cast<const Image*>(element);
+      out.push_back( image->position );
+      out.push_back( image->position + image->dimension );
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void DisplayList::triangulate_polygons( const vector<uint32_t>& polygons ) {
+
+  // the ear clipper dominates compile time on large documents, polygons
+  // are independent so they are triangulated concurrently
+  vector<vector<uint32_t> > triangles( polygons.size() );
+  #pragma omp parallel for schedule(dynamic)
+  for ( int i = 0; i < (int) polygons.size(); ++i ) {
+    const DisplayCommand& cmd = commands[polygons[i]];
+    const Polygon& polygon = *static_cast<const Polygon*>(cmd.element);
+
+    // non-simple outlines keep no triangles, they are filled directly
+    if ( !CMU462::triangulate( polygon, triangles[i] ) ) triangles[i].clear();
+  }
+
+  for (size_t i = 0; i < polygons.size(); i++) {
+    DisplayCommand& cmd = commands[polygons[i]];
+    const vector<uint32_t>& t = triangles[i];
+    if ( t.size() <= cmd.tri_count ) {
+      copy( t.begin(), t.end(), indices.begin() + cmd.tri_first );
+      unused_indices += cmd.tri_count - t.size();
+    } else {
+      unused_indices += cmd.tri_count;
+      cmd.tri_first = indices.size();
+      indices.insert( indices.end(), t.begin(), t.end() );
+    }
+    cmd.tri_count = t.size();
+  }
+
+  if ( unused_indices > indices.size() / 2 ) compact_indices();
+}
+
+void DisplayList::compact_indices() {
+
+  vector<uint32_t> compacted;
+  compacted.reserve( indices.size() - unused_indices );
+  for (size_t i = 0; i < commands.size(); i++) {
+    DisplayCommand& cmd = commands[i];
+    if ( cmd.kind != POLYGON ) continue;
+    compacted.insert( compacted.end(), indices.begin() + cmd.tri_first,
+                      indices.begin() + cmd.tri_first + cmd.tri_count );
+    cmd.tri_first = compacted.size() - cmd.tri_count;
+  }
+  indices.swap( compacted );
+  unused_indices = 0;
+}
+
+bool DisplayList::update_geometry( const SVGElement* element ) {
+
+  if ( !compiled || element->type == GROUP ) return false;
+
+  for (size_t i = 0; i < commands.size(); i++) {
+    DisplayCommand& cmd = commands[i];
+    if ( cmd.element != element ) continue;
+
+    vector<Vector2D> geometry;
+    add_points( element, geometry );
+    if ( geometry.size() != cmd.count ) return false;
+    copy( geometry.begin(), geometry.end(), points.begin() + cmd.first );
+
+    if ( cmd.kind == POLYGON ) {
+      cmd.rule = static_cast<const Polygon*>(element)->fillRule;
+      if ( triangulated ) triangulate_polygons( vector<uint32_t>( 1, i ) );
+    }
+    return true;
+  }
+  return false;
+}
+
+} // namespace CMU462
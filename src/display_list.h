@@ -0,0 +1,149 @@
+#ifndef CMU462_DISPLAY_LIST_H
+#define CMU462_DISPLAY_LIST_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "CMU462.h"
+#include "color.h"
+#include "vector2D.h"
+#include "matrix3x3.h"
+
+namespace CMU462 {
+
+struct SVG;
+struct SVGElement;
+struct Texture;
+
+/**
+ * Affine transformation in single precision, mapping (x, y) to
+ * (a x + c y + e, b x + d y + f) like svg's matrix(a b c d e f).
+ */
+struct Affine2D {
+
+  Affine2D( ) : a (1), b (0), c (0), d (1), e (0), f (0) { }
+
+  // the affine part (top two rows) of m
+  explicit Affine2D( const Matrix3x3& m )
+    : a (m(0,0)), b (m(1,0)), c (m(0,1)),
+      d (m(1,1)), e (m(0,2)), f (m(1,2)) { }
+
+  inline Matrix3x3 to_matrix() const {
+    double m[9] = { a, c, e,
+                    b, d, f,
+                    0, 0, 1 };
+    return Matrix3x3( m );
+  }
+
+  float a, b, c, d, e, f;
+
+}; // struct Affine2D
+
+/**
+ * A drawing command of a display list, one per svg element. The geometry
+ * of the element is stored as points: the position of points, the end
+ * points of lines, the vertices of polylines and polygons, the corners of
+ * rectangles (top left, top right, bottom left, bottom right), center and
+ * radius of ellipses and the two corners of images. Polygons also refer
+ * to their triangulation, a range of indices into their points.
+ */
+struct DisplayCommand {
+  uint8_t kind;              // SVGElementType of the element
+  uint8_t rule;              // FillRule of polygons
+  uint32_t transform;        // index into DisplayList::transforms
+  uint32_t first, count;     // range of points, or of children for groups
+  uint32_t tri_first;        // range of triangle indices of polygons
+  uint32_t tri_count;
+  Color fill, stroke;        // style colors
+  Texture* tex;              // texture of images
+  const SVGElement* element; // source element
+};
+
+/**
+ * An svg document flattened into a linear command buffer. Commands are
+ * stored in painter's order, each group followed by its subtree, and
+ * refer to their transformation from object to svg coordinates (with
+ * the transforms of all enclosing groups pre-concatenated) by index, so
+ * drawing needs no matrix stack and elements without a transform of
+ * their own share the one of their parent. Svg transforms are affine,
+ * they are cached as 2x3 floats; the view only adds the svg to screen
+ * transformation, which renderers compose at draw time. The list only
+ * depends on the document, it is compiled again when the document
+ * changes but not when the view does. Polygons are only triangulated
+ * for renderers that draw their triangles (triangulate, which does all
+ * of them in parallel); until then they have no triangles and are filled
+ * directly.
+ */
+struct DisplayList {
+
+  DisplayList( ) : root_count (0), compiled (false), triangulated (false),
+                   unused_indices (0) { }
+
+  // flatten svg, replacing the previous contents
+  void compile( SVG& svg );
+
+  // drop all commands
+  void clear();
+
+  // triangulate all polygons, unless they are already
+  void triangulate();
+
+  // Update the points (and the triangulation) of element after its
+  // geometry was edited. Returns false if that needs a full compile,
+  // which is when the element has no command or its number of points
+  // changed.
+  bool update_geometry( const SVGElement* element );
+
+  inline bool is_compiled() const { return compiled; }
+
+  inline bool is_triangulated() const { return triangulated; }
+
+  // commands in painter's order
+  std::vector<DisplayCommand> commands;
+
+  // object to svg transformations, transforms[0] is the identity
+  std::vector<Affine2D> transforms;
+
+  // geometry of all commands
+  std::vector<Vector2D> points;
+
+  // triangles of all polygons once triangulated, three indices each
+  // relative to the first point of their command
+  std::vector<uint32_t> indices;
+
+  // Command indices of the children of every group, in order. The
+  // document's own elements are the first root_count entries.
+  std::vector<uint32_t> children;
+  size_t root_count;
+
+ private:
+
+  // append the commands of element and its subtree, whose parent has the
+  // given transform (at index parent_transform), and return the index of
+  // its command
+  uint32_t add( SVGElement* element, const Matrix3x3& parent,
+                uint32_t parent_transform );
+
+  // append the geometry of a non-group element to out
+  static void add_points( const SVGElement* element,
+                          std::vector<Vector2D>& out );
+
+  // Triangulate the polygons with the given command indices. Their new
+  // triangles replace the old ones where they fit and are appended
+  // otherwise.
+  void triangulate_polygons( const std::vector<uint32_t>& polygons );
+
+  // drop the indices no command refers to
+  void compact_indices();
+
+  bool compiled;
+  bool triangulated;
+
+  // indices left behind by polygons whose triangles changed
+  size_t unused_indices;
+
+}; // struct DisplayList
+
+} // namespace CMU462
+
+#endif // CMU462_DISPLAY_LIST_H
@@ -2,14 +2,24 @@
 
 #include <sstream>
 #include <iostream>
+#include <cmath>
 #include <cstdlib>
 
 using namespace std;
 
 namespace CMU462 {
 
+// Time (in milliseconds) progressive refinement may take per frame, and
+// since the last pan or zoom before the work of idle frames (refinement,
+// tile prefetching, prerendering) starts
+static const double kIdleBudget = 1000.0 / 60;
+static const double kIdleDelay = 100;
+
 DrawSVG::~DrawSVG() {
 
+  render_thread.stop();
+  background.clear();
+  images.clear();
   tabs.clear();
   viewport_imp.clear();
   viewport_ref.clear();
@@ -38,8 +48,42 @@ string DrawSVG::info() {
     if (software_renderer == software_renderer_ref) {
       osd += "- Reference";
     }
-    if (sample_rate > 1) {
-      osd += "( " + to_string(sample_rate * sample_rate) + "x SSAA)";
+    if (progressive && software_renderer == software_renderer_imp) {
+      osd += "(progressive " +
+             to_string(software_renderer_imp->refinement_passes()) + "/" +
+             to_string(16 * sample_rate * sample_rate) + ")";
+    } else if (sample_rate > 1) {
+      bool msaa = software_renderer == software_renderer_imp &&
+                  software_renderer_imp->is_msaa();
+      osd += "( " + to_string(sample_rate * sample_rate) + 
+             (msaa ? "x MSAA)" : "x SSAA)");
+    }
+    if (software_renderer == software_renderer_imp &&
+        software_renderer_imp->is_binned()) {
+      osd += " [binned]";
+    }
+    if (software_renderer == software_renderer_imp &&
+        software_renderer_imp->get_sample_format() == SAMPLE_RGBA16) {
+      osd += " [16 bit]";
+    }
+    if (software_renderer == software_renderer_imp &&
+        software_renderer_imp->is_analytic()) {
+      osd += " [area AA]";
+    }
+    if (software_renderer == software_renderer_imp &&
+        !software_renderer_imp->is_scanline()) {
+      osd += " [triangulated]";
+    }
+    if (software_renderer == software_renderer_imp &&
+        !software_renderer_imp->is_culling()) {
+      osd += " [no culling]";
+    }
+    if (use_tile_cache()) {
+      osd += " [tile cache " +
+             to_string(tile_cache.memory_usage() >> 20) + " MB]";
+    }
+    if (use_render_thread()) {
+      osd += " [threaded]";
     }
   }
 
@@ -64,7 +108,8 @@ void DrawSVG::init() {
   software_renderer_imp->set_tex_sampler(sampler_imp);
   software_renderer_ref->set_tex_sampler(sampler_ref);
 
-  // generate mipmaps & set initial viewports
+  // set initial viewports, the textures of images are decoded once they
+  // are in view
   for (size_t i = 0; i < tabs.size(); ++i) {
 
     viewport_imp.push_back(new ViewportImp());
@@ -75,9 +120,6 @@ void DrawSVG::init() {
 
     // set initial svg_2_norm for imp using ref
     viewport_imp[i]->set_svg_2_norm(viewport_ref[i]->get_svg_2_norm());
-
-    // generate mipmaps
-    regenerate_mipmap(i);
   }
 
   // set tab and transformation if tabs loaded
@@ -90,12 +132,29 @@ void DrawSVG::init() {
 
 void DrawSVG::render() {
 
+  if (images.has_decoded()) install_images();
+
   if (method == Hardware ) {
     redraw();
   }
 
   if( method == Software ) {
-    display_pixels( &framebuffer[0] );
+    if (refining()) refine();
+    if (use_tile_cache()) {
+      tile_cache.collect();
+      if (idle()) tile_cache.prefetch();
+    }
+    if (prerendering() && idle()) prerender();
+
+    // the newest frame of the render thread, if newer than the
+    // framebuffer and still of the window size
+    const RenderThread::Frame& frame = render_thread.latest();
+    if (use_render_thread() && frame.seq > framebuffer_seq &&
+        frame.spec.width == width && frame.spec.height == height) {
+      display_pixels( &frame.pixels[0] );
+    } else {
+      display_pixels( &framebuffer[0] );
+    }
   }
 
   if (show_zoom) {
@@ -152,14 +211,76 @@ void DrawSVG::char_event( unsigned int key ) {
       setRenderMethod( Software );
       break;
 
+    // toggle tile-binned rasterization
+    case 'b': case 'B':
+      software_renderer_imp->set_binned(!software_renderer_imp->is_binned());
+      redraw();
+      break;
+
+    // toggle compressed MSAA storage, full sample buffers stay at 4x4
+    case 'm': case 'M':
+      software_renderer_imp->set_msaa(!software_renderer_imp->is_msaa());
+      if (!software_renderer_imp->is_msaa() && sample_rate > 4) {
+        sample_rate = 4;
+        software_renderer_imp->set_sample_rate(progressive ? 1 : sample_rate);
+      }
+      redraw();
+      break;
+
+    // toggle progressive refinement, which draws one sample per pixel
+    case 'p': case 'P':
+      progressive = !progressive;
+      software_renderer_imp->set_sample_rate(progressive ? 1 : sample_rate);
+      redraw();
+      break;
+
+    // toggle the tile cache
+    case 'k': case 'K':
+      tile_caching = !tile_caching;
+      redraw();
+      break;
+
+    // toggle the render thread
+    case 'i': case 'I':
+      threaded = !threaded;
+      redraw();
+      break;
+
+    // toggle analytic coverage of polygon fills
+    case 'a': case 'A':
+      software_renderer_imp->set_analytic(!software_renderer_imp->is_analytic());
+      redraw();
+      break;
+
+    // toggle scanline/triangulated polygon fills
+    case 't': case 'T':
+      if (software_renderer_imp->is_scanline()) triangulate_tabs();
+      software_renderer_imp->set_scanline(!software_renderer_imp->is_scanline());
+      redraw();
+      break;
+
+    // toggle view culling
+    case 'c': case 'C':
+      software_renderer_imp->set_culling(!software_renderer_imp->is_culling());
+      redraw();
+      break;
+
+    // toggle 8/16 bit sample buffer
+    case 'f': case 'F':
+      software_renderer_imp->set_sample_format(
+        software_renderer_imp->get_sample_format() == SAMPLE_RGBA8 ?
+        SAMPLE_RGBA16 : SAMPLE_RGBA8);
+      redraw();
+      break;
+
     // switch between iml and ref sampler
     case ';':
       sampler = sampler_imp;
-      regenerate_mipmap(current_tab); redraw();
+      regenerate_mipmap(); redraw();
       break;
     case '\'':
       sampler = sampler_ref;
-      regenerate_mipmap(current_tab); redraw();
+      regenerate_mipmap(); redraw();
       break;
 
     // change render method
@@ -243,14 +364,26 @@ void DrawSVG::cursor_event( float x, float y ) {
   
   // translate when left mouse button is held down
   // diff is disabled when panning - it's too slow
+  // The svg follows the cursor in steps of whole pixels, so the frame
+  // can be shifted instead of redrawn. The rest of the motion is kept
+  // for the next event.
   if (leftDown) {
   
     show_diff = false;
-    float dx = (x - cursor_x) / width  * tabs[current_tab]->width;
-    float dy = (y - cursor_y) / height * tabs[current_tab]->height;
-    viewport_imp[current_tab]->update_viewbox(dx, dy, 1);
-    viewport_ref[current_tab]->update_viewbox(dx, dy, 1);
-    redraw();
+    last_interaction = chrono::steady_clock::now();
+    float px = floor(x - cursor_x + 0.5f);
+    float py = floor(y - cursor_y + 0.5f);
+    if (px || py) {
+      Matrix3x3 m = norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm();
+      float dx = px / m(0,0);
+      float dy = py / m(1,1);
+      viewport_imp[current_tab]->update_viewbox(dx, dy, 1);
+      viewport_ref[current_tab]->update_viewbox(dx, dy, 1);
+      pan();
+    }
+    cursor_x += px;
+    cursor_y += py;
+    return;
   }
   
   // register new cursor location
@@ -262,9 +395,19 @@ void DrawSVG::scroll_event( float offset_x, float offset_y ) {
   // diff is disabled when zooming - it's too slow
   if (offset_x || offset_y) {
     show_diff = false;
+    last_interaction = chrono::steady_clock::now();
     // prevent inverting axis when scrolling too fast
     float scale = 1 + 0.05 * offset_x + 0.05 * offset_y;
     scale = scale < 0.5 ? 0.5 : (scale > 1.5 ? 1.5 : scale); 
+
+    // the tile cache draws zoom levels, go to the nearest one in the
+    // direction of the zoom (or the next one)
+    if (use_tile_cache()) {
+      double s = (norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm())(0,0);
+      int level = TileCache::level(s), next = TileCache::level(s / scale);
+      if (next == level) next += scale < 1 ? 1 : -1;
+      scale = s / TileCache::level_scale(next);
+    }
     viewport_imp[current_tab]->update_viewbox(0, 0, scale);
     viewport_ref[current_tab]->update_viewbox(0, 0, scale);
     redraw();
@@ -292,7 +435,11 @@ void DrawSVG::newTab( SVG* svg ) {
 
 void DrawSVG::delTab( size_t tab_index ) {
   if (tab_index < tabs.size()) {
+    render_thread.stop();
     tabs.erase(tabs.begin() + tab_index);
+    tile_cache.clear();
+    background.clear();
+    images.clear();
   }
 }
 
@@ -303,8 +450,8 @@ void DrawSVG::setTab( size_t tab_index ) {
     // switch tab and update transformation
     current_tab = tab_index;
 
-    // update output
-    redraw();
+    // update output, unless the tab was rendered in the background
+    if (!show_prerendered()) redraw();
   }
 }
 
@@ -416,9 +563,10 @@ void DrawSVG::draw_zoom() {
 
 void DrawSVG::inc_sample_rate() {
   if (method == Software) {
-    sample_rate += sample_rate < 4 ? 1 : 0;
-    software_renderer_imp->set_sample_rate(sample_rate);
-    software_renderer_ref->set_sample_rate(sample_rate);
+    size_t max_rate = software_renderer_imp->is_msaa() ? 8 : 4;
+    sample_rate += sample_rate < max_rate ? 1 : 0;
+    software_renderer_imp->set_sample_rate(progressive ? 1 : sample_rate);
+    software_renderer_ref->set_sample_rate(min(sample_rate, (size_t) 4));
     redraw();
   }
 }
@@ -426,15 +574,15 @@ void DrawSVG::inc_sample_rate() {
 void DrawSVG::dec_sample_rate() {
   if (method == Software) {
     sample_rate -= sample_rate > 1 ? 1 : 0;
-    software_renderer_imp->set_sample_rate(sample_rate);
-    software_renderer_ref->set_sample_rate(sample_rate);
+    software_renderer_imp->set_sample_rate(progressive ? 1 : sample_rate);
+    software_renderer_ref->set_sample_rate(min(sample_rate, (size_t) 4));
     redraw();
   }
 }
 
 void DrawSVG::redraw() {
 
-  clear();
+  if (use_tile_cache()) snap_zoom(current_tab);
 
   // set svg_2_screen transformation
   Matrix3x3 m_imp = norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm();
@@ -442,7 +590,16 @@ void DrawSVG::redraw() {
   software_renderer_imp->set_svg_2_screen( m_imp ); 
   software_renderer_ref->set_svg_2_screen( m_ref ); 
   hardware_renderer->set_svg_2_screen( m_ref );
+  images.request_visible(*tabs[current_tab], m_imp, width, height, sampler);
 
+  // the render thread draws the frame, render shows it once done
+  if (use_render_thread()) {
+    render_thread.post(frame_spec(current_tab), ++frame_seq);
+    frame_pannable = false;
+    return;
+  }
+
+  clear();
   switch (method) {
 
     case Hardware:  
@@ -452,25 +609,207 @@ void DrawSVG::redraw() {
     case Software: 
 
       if (show_diff) { draw_diff(); return; }
-      software_renderer->draw_svg(*tabs[current_tab]);
+      if (!use_tile_cache() ||
+          !tile_cache.draw(frame_spec(current_tab), &framebuffer[0])) {
+        software_renderer->draw_svg(*tabs[current_tab]);
+      }
+      if (progressive && software_renderer == software_renderer_imp) {
+        software_renderer_imp->restart_refinement();
+      }
+      framebuffer_seq = ++frame_seq;
       display_pixels( &framebuffer[0] );
       break;
 
   }
+
+  // remember the frame for pan
+  frame_svg_2_screen = m_imp;
+  frame_pannable = method == Software &&
+                   software_renderer == software_renderer_imp;
 }
 
-void DrawSVG::regenerate_mipmap(size_t tab_index) {
-  if (tab_index < tabs.size()) {
-    SVG* svg = tabs[tab_index];
-    for ( size_t i = 0; i < svg->elements.size(); ++i ) {
-  
-      SVGElement* element = svg->elements[i];
-      if (element->type == IMAGE) {
-          Texture& tex = static_cast<Image*>(element)->tex;
-          sampler->generate_mips(tex, 0);
-      }
+void DrawSVG::pan() {
+
+  // only valid for a frame of the software renderer, the tile cache
+  // draws pans from its tiles instead and the render thread pans its
+  // own frames
+  if (!frame_pannable || method != Software || show_diff ||
+      use_tile_cache() || use_render_thread()) {
+    redraw();
+    return;
+  }
+
+  // Translation of the view since the frame was drawn. The frame is
+  // shifted if that is whole pixels (up to rounding of the viewbox) and
+  // the scale did not change, otherwise it is drawn again.
+  Matrix3x3 m_imp = norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm();
+  Matrix3x3 m_ref = norm_to_screen * viewport_ref[current_tab]->get_svg_2_norm();
+  const Matrix3x3& f = frame_svg_2_screen;
+  double tx = m_imp(0,2) - f(0,2), ty = m_imp(1,2) - f(1,2);
+  double dx = floor(tx + 0.5), dy = floor(ty + 0.5);
+  const double tolerance = 1.0 / 64;
+  if (m_imp(0,0) != f(0,0) || m_imp(0,1) != f(0,1) ||
+      m_imp(1,0) != f(1,0) || m_imp(1,1) != f(1,1) ||
+      fabs(tx - dx) > tolerance || fabs(ty - dy) > tolerance) {
+    redraw();
+    return;
+  }
+
+  software_renderer_imp->set_svg_2_screen( m_imp );
+  software_renderer_ref->set_svg_2_screen( m_ref );
+  hardware_renderer->set_svg_2_screen( m_ref );
+  images.request_visible(*tabs[current_tab], m_imp, width, height, sampler);
+  software_renderer_imp->pan_svg(*tabs[current_tab], (int) dx, (int) dy);
+  if (progressive) software_renderer_imp->restart_refinement();
+  framebuffer_seq = ++frame_seq;
+  display_pixels( &framebuffer[0] );
+
+  // the frame is now the previous one moved by whole pixels, which keeps
+  // the rounding from adding up over many pans
+  frame_svg_2_screen(0,2) += dx;
+  frame_svg_2_screen(1,2) += dy;
+}
+
+bool DrawSVG::idle() const {
+  chrono::duration<double, milli> idle =
+    chrono::steady_clock::now() - last_interaction;
+  return idle.count() >= kIdleDelay;
+}
+
+bool DrawSVG::refining() const {
+
+  if (!progressive || show_diff) return false;
+  if (software_renderer != software_renderer_imp) return false;
+
+  // wait until the view stopped changing
+  if (!idle()) return false;
+
+  size_t passes = 16 * sample_rate * sample_rate;
+  return software_renderer_imp->refinement_passes() < passes;
+}
+
+void DrawSVG::refine() {
+
+  // as many passes as fit in the frame, but at least one
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  chrono::duration<double, milli> elapsed;
+  do {
+    software_renderer_imp->refine_svg(*tabs[current_tab]);
+    elapsed = chrono::steady_clock::now() - start;
+  } while (refining() && elapsed.count() < kIdleBudget);
+}
+
+bool DrawSVG::use_tile_cache() const {
+  return tile_caching && method == Software && !show_diff && !progressive &&
+         software_renderer == software_renderer_imp;
+}
+
+void DrawSVG::snap_zoom( size_t tab ) {
+
+  // scale both viewports to the nearest zoom level of the cache
+  double s = (norm_to_screen * viewport_imp[tab]->get_svg_2_norm())(0,0);
+  double level = TileCache::level_scale(TileCache::level(s));
+  if (fabs(s / level - 1) < 1e-6) return;
+  viewport_imp[tab]->update_viewbox(0, 0, s / level);
+  viewport_ref[tab]->update_viewbox(0, 0, s / level);
+}
+
+bool DrawSVG::use_render_thread() const {
+  return threaded && method == Software && !show_diff && !progressive &&
+         !tile_caching && software_renderer == software_renderer_imp;
+}
+
+bool DrawSVG::prerendering() const {
+  return method == Software && !show_diff && !progressive &&
+         software_renderer == software_renderer_imp;
+}
+
+FrameSpec DrawSVG::frame_spec( size_t tab ) {
+
+  // the view redraw would draw, which the tile cache snaps to its zoom
+  // levels and whole pixels
+  if (use_tile_cache()) snap_zoom(tab);
+  Matrix3x3 m = norm_to_screen * viewport_imp[tab]->get_svg_2_norm();
+  if (use_tile_cache()) {
+    m(0,0) = m(1,1) = TileCache::level_scale(TileCache::level(m(0,0)));
+    m(0,2) = floor(m(0,2) + 0.5);
+    m(1,2) = floor(m(1,2) + 0.5);
+  }
+
+  FrameSpec spec;
+  spec.tab = tab;
+  spec.svg = tabs[tab];
+  spec.sampler = sampler;
+  spec.svg_2_screen = m;
+  spec.width = width;
+  spec.height = height;
+  spec.sample_rate = sample_rate;
+  spec.msaa = software_renderer_imp->is_msaa();
+  spec.analytic = software_renderer_imp->is_analytic();
+  spec.scanline = software_renderer_imp->is_scanline();
+  spec.sample_format = software_renderer_imp->get_sample_format();
+  return spec;
+}
+
+void DrawSVG::prerender() {
+  for (size_t i = 0; i < tabs.size(); ++i) {
+    if (i != current_tab) background.schedule(frame_spec(i));
+  }
+}
+
+bool DrawSVG::show_prerendered() {
+
+  if (!prerendering()) return false;
+  FrameSpec spec = frame_spec(current_tab);
+  if (!background.take(spec, &framebuffer[0])) return false;
+
+  // as after a redraw of the view
+  Matrix3x3 m_ref = norm_to_screen * viewport_ref[current_tab]->get_svg_2_norm();
+  software_renderer_imp->set_svg_2_screen( spec.svg_2_screen );
+  software_renderer_ref->set_svg_2_screen( m_ref );
+  hardware_renderer->set_svg_2_screen( m_ref );
+  images.request_visible(*tabs[current_tab], spec.svg_2_screen,
+                         width, height, sampler);
+  frame_svg_2_screen = spec.svg_2_screen;
+  frame_pannable = true;
+  framebuffer_seq = ++frame_seq;
+  display_pixels( &framebuffer[0] );
+  return true;
+}
+
+void DrawSVG::regenerate_mipmap() {
+  render_thread.stop();
+  tile_cache.clear();
+  background.clear();
+  images.regenerate(sampler);
+}
+
+void DrawSVG::triangulate_tabs() {
+  render_thread.stop();
+  tile_cache.clear();
+  background.clear();
+  for (size_t i = 0; i < tabs.size(); ++i) {
+    tabs[i]->display_list.triangulate();
+  }
+}
+
+void DrawSVG::install_images() {
+
+  // Only the tiles and frames of images whose textures change are
+  // dropped (decoded ones still show placeholders there), and nothing
+  // may draw those images meanwhile. The render thread may still draw
+  // the previous tab, so it is stopped.
+  vector<ImageLoader::Region> regions;
+  images.take_decoded(regions);
+  render_thread.stop();
+  for (size_t i = 0; i < regions.size(); ++i) {
+    for (size_t tab = 0; tab < tabs.size(); ++tab) {
+      if (tabs[tab] != regions[i].svg) continue;
+      tile_cache.drop(tab, regions[i].bounds);
+      background.drop(tab, regions[i].bounds);
     }
   }
+  if (images.install(sampler)) redraw();
 }
 
 void DrawSVG::auto_adjust(size_t tab_index) {
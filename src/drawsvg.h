@@ -1,6 +1,7 @@
 #ifndef CMU462_DRAWSVG_H
 #define CMU462_DRAWSVG_H
 
+#include <chrono>
 #include <vector>
 
 #include "CMU462.h"
@@ -8,6 +9,10 @@
 #include "svg.h"
 #include "hardware_renderer.h"
 #include "software_renderer.h"
+#include "tile_cache.h"
+#include "background_renderer.h"
+#include "render_thread.h"
+#include "image_loader.h"
 
 namespace CMU462 {
 
@@ -41,7 +46,13 @@ class DrawSVG : public Renderer {
     current_tab (0),
     show_diff (false),
     show_zoom (false),
-    norm_to_screen ( Matrix3x3::identity() )  { }
+    progressive (false),
+    tile_caching (false),
+    threaded (true),
+    frame_seq (0),
+    norm_to_screen ( Matrix3x3::identity() ),
+    framebuffer_seq (0),
+    frame_pannable (false)  { }
 
   /**
    * Destructor.
@@ -117,6 +128,20 @@ class DrawSVG : public Renderer {
    */
   int getErrorCount( void ) const;
 
+  /**
+   * Set the memory budget (in bytes) of the tile cache.
+   */
+  inline void setTileCacheBudget( size_t budget ) {
+    tile_cache.set_budget( budget );
+  }
+
+  /**
+   * Set the memory budget (in bytes) of decoded images.
+   */
+  inline void setImageBudget( size_t budget ) {
+    images.set_budget( budget );
+  }
+
  private:
 
   /* window size */
@@ -139,7 +164,7 @@ class DrawSVG : public Renderer {
 
   /* software renderer */
   SoftwareRenderer* software_renderer;
-  SoftwareRenderer* software_renderer_imp;
+  SoftwareRendererImp* software_renderer_imp;
   SoftwareRenderer* software_renderer_ref;
 
   /* texture sampler */
@@ -160,13 +185,57 @@ class DrawSVG : public Renderer {
   bool show_zoom;
   void draw_zoom();
 
+  /* progressive mode: the software renderer draws one sample per pixel
+     while the view changes and refines the frame once idle, up to
+     (4 * sample_rate)^2 passes */
+  bool progressive;
+  std::chrono::steady_clock::time_point last_interaction;
+  bool idle() const;
+  bool refining() const;
+  void refine();
+
+  /* tile cache of the software renderer, views are drawn from it at
+     zoom levels of the cache, render shows its tiles as its thread
+     finishes them and idle frames prefetch tiles */
+  TileCache tile_cache;
+  bool tile_caching;
+  bool use_tile_cache() const;
+  void snap_zoom( size_t tab );
+
+  /* background rendering of the other tabs: idle frames queue their
+     views and switching to a tab shows its frame once done */
+  BackgroundRenderer background;
+  bool prerendering() const;
+  FrameSpec frame_spec( size_t tab );
+  void prerender();
+  bool show_prerendered();
+
+  /* render thread of the software renderer: redraw posts the view and
+     render shows the newest finished frame, unless the framebuffer was
+     drawn since. Frames are numbered in the order they were asked for.
+     Progressive mode draws on the UI thread instead, and the tile cache
+     on a thread of its own. */
+  RenderThread render_thread;
+  bool threaded;
+  size_t frame_seq;
+  bool use_render_thread() const;
+
   /* samples rate (sqrt(s/pix)) */
   size_t sample_rate;
   void inc_sample_rate();
   void dec_sample_rate();
 
-  /* regenerate mipmap */
-  void regenerate_mipmap(size_t tab_index);
+  /* images are decoded once in view, by a thread of the loader: views
+     ask for their images and render installs decoded ones, which drops
+     the frames drawn before */
+  ImageLoader images;
+  void install_images();
+
+  /* regenerate the mipmaps of decoded images with the current sampler */
+  void regenerate_mipmap();
+
+  /* triangulate the polygons of all tabs, for the triangulated fill */
+  void triangulate_tabs();
 
   /* audo-adjust canvas_to_norm */
   void auto_adjust(size_t tab_index);
@@ -178,12 +247,22 @@ class DrawSVG : public Renderer {
   std::vector<Matrix3x3> viewport_save_imp;
   std::vector<Matrix3x3> viewport_save_ref;
 
-  /* framebuffer for software renderer */
+  /* framebuffer for software renderer, and the number of its frame */
   std::vector<unsigned char> framebuffer;
+  size_t framebuffer_seq;
+
+  /* svg_2_screen of the frame in the framebuffer, which can be panned
+     if it was drawn by software_renderer_imp */
+  Matrix3x3 frame_svg_2_screen;
+  bool frame_pannable;
 
   // update framebuffer
   void redraw();
 
+  // update framebuffer after the view was translated, only drawing the
+  // exposed strips if the frame moved by whole pixels
+  void pan();
+
   /* update framebuffer for software renderer */
   void display_pixels( const unsigned char* pixels ) const;
 
@@ -0,0 +1,307 @@
+#include "image_loader.h"
+
+#include "png.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+// color of images that are not decoded (yet)
+static const unsigned char kPlaceholder[4] = { 224, 224, 224, 255 };
+
+// bytes of the texels of all levels of tex
+static size_t texture_bytes( const Texture& tex ) {
+  size_t bytes = 0;
+  for ( size_t i = 0; i < tex.mipmap.size(); ++i ) {
+    bytes += tex.mipmap[i].texels.size();
+  }
+  return bytes;
+}
+
+ImageLoader::ImageLoader( size_t budget )
+  : budget (budget), usage (0), requests (0), busy (false),
+    stopping (false) {
+
+  thread = std::thread( &ImageLoader::run, this );
+}
+
+ImageLoader::~ImageLoader( ) {
+
+  {
+    lock_guard<std::mutex> lock( mutex );
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void ImageLoader::placeholder( Texture& tex ) {
+
+  tex.width = tex.height = 1;
+  tex.mipmap.assign( 1, MipLevel() );
+  tex.mipmap[0].width = tex.mipmap[0].height = 1;
+  tex.mipmap[0].texels.assign( kPlaceholder, kPlaceholder + 4 );
+}
+
+bool ImageLoader::decode( const Image& image, Sampler2D* sampler,
+                          Texture& tex ) {
+
+  // tex is left as it is on failure
+  PNG png;
+  if ( image.png.empty() ||
+       PNGParser::load( &image.png[0], image.png.size(), png ) ) {
+    return false;
+  }
+
+  tex.width = png.width;
+  tex.height = png.height;
+  tex.mipmap.assign( 1, MipLevel() );
+  tex.mipmap[0].width = png.width;
+  tex.mipmap[0].height = png.height;
+  tex.mipmap[0].texels.swap( png.pixels );
+  if ( sampler ) sampler->generate_mips( tex, 0 );
+  return true;
+}
+
+void ImageLoader::visible( SVG& svg, const Matrix3x3& svg_2_screen,
+                           size_t width, size_t height,
+                           vector<Image*>& images, vector<BBox2D>& bounds ) {
+
+  BBox2D view;
+  view.expand( Vector2D( 0, 0 ) );
+  view.expand( Vector2D( width, height ) );
+
+  const DisplayList& list = svg.display_list;
+  for ( size_t i = 0; i < list.commands.size(); ++i ) {
+
+    const DisplayCommand& cmd = list.commands[i];
+    if ( cmd.kind != IMAGE ) continue;
+
+    BBox2D box;
+    box.expand( list.points[cmd.first] );
+    box.expand( list.points[cmd.first + 1] );
+    box = box.transformed( list.transforms[cmd.transform].to_matrix() );
+    if ( box.transformed( svg_2_screen ).intersects( view ) ) {
+      images.push_back( const_cast<Image*>(
+                          static_cast<const Image*>(cmd.element) ) );
+      bounds.push_back( box );
+    }
+  }
+}
+
+void ImageLoader::load_visible( SVG& svg, const Matrix3x3& svg_2_screen,
+                                size_t width, size_t height,
+                                Sampler2D* sampler ) {
+
+  vector<Image*> images;
+  vector<BBox2D> bounds;
+  visible( svg, svg_2_screen, width, height, images, bounds );
+  for ( size_t i = 0; i < images.size(); ++i ) {
+    decode( *images[i], sampler, images[i]->tex );
+  }
+}
+
+void ImageLoader::request_visible( SVG& svg, const Matrix3x3& svg_2_screen,
+                                   size_t width, size_t height,
+                                   Sampler2D* sampler ) {
+
+  vector<Image*> images;
+  vector<BBox2D> bounds;
+  visible( svg, svg_2_screen, width, height, images, bounds );
+
+  ++requests;
+  vector<Job> jobs;
+  for ( size_t i = 0; i < images.size(); ++i ) {
+
+    map<Image*, Entry>::iterator entry = entries.find( images[i] );
+    if ( entry != entries.end() ) {
+      entry->second.last_seen = requests;
+      continue;
+    }
+
+    Region region = { &svg, bounds[i] };
+    Entry e = { QUEUED, requests, 0, sampler, region };
+    entries[images[i]] = e;
+    Job job = { images[i], sampler };
+    jobs.push_back( job );
+  }
+
+  if ( jobs.empty() ) return;
+  {
+    lock_guard<std::mutex> lock( mutex );
+    queue.insert( queue.end(), jobs.begin(), jobs.end() );
+  }
+  wake.notify_one();
+}
+
+bool ImageLoader::has_decoded() {
+  lock_guard<std::mutex> lock( mutex );
+  return !decoded.empty();
+}
+
+void ImageLoader::take_decoded( vector<Region>& regions ) {
+
+  size_t n = taken.size();
+  {
+    lock_guard<std::mutex> lock( mutex );
+    taken.resize( n + decoded.size() );
+    for ( size_t i = 0; i < decoded.size(); ++i ) {
+      Decoded& d = taken[n + i];
+      d.job = decoded[i].job;
+      d.ok = decoded[i].ok;
+      d.tex.width = decoded[i].tex.width;
+      d.tex.height = decoded[i].tex.height;
+      d.tex.mipmap.swap( decoded[i].tex.mipmap );
+    }
+    decoded.clear();
+  }
+
+  for ( size_t i = n; i < taken.size(); ++i ) {
+    if ( taken[i].ok ) regions.push_back( entries[taken[i].job.image].region );
+  }
+
+  pick_evictions();
+  for ( size_t i = 0; i < evicting.size(); ++i ) {
+    regions.push_back( entries[evicting[i]].region );
+  }
+}
+
+bool ImageLoader::install( Sampler2D* sampler ) {
+
+  vector<Decoded> finished;
+  finished.swap( taken );
+
+  bool changed = false;
+  for ( size_t i = 0; i < finished.size(); ++i ) {
+
+    Decoded& d = finished[i];
+    Entry& entry = entries[d.job.image];
+    if ( !d.ok ) {
+      entry.state = FAILED;
+      continue;
+    }
+
+    Texture& tex = d.job.image->tex;
+    tex.width = d.tex.width;
+    tex.height = d.tex.height;
+    tex.mipmap.swap( d.tex.mipmap );
+    if ( d.job.sampler != sampler ) sampler->generate_mips( tex, 0 );
+
+    entry.state = INSTALLED;
+    entry.sampler = sampler;
+    entry.bytes = texture_bytes( tex );
+    usage += entry.bytes;
+    changed = true;
+  }
+
+  bool evicted = false;
+  for ( size_t i = 0; i < evicting.size(); ++i ) {
+    map<Image*, Entry>::iterator entry = entries.find( evicting[i] );
+    if ( entry == entries.end() || entry->second.state != INSTALLED ) continue;
+    placeholder( entry->first->tex );
+    usage -= entry->second.bytes;
+    entries.erase( entry );
+    evicted = true;
+  }
+  evicting.clear();
+
+  return evicted || changed;
+}
+
+void ImageLoader::regenerate( Sampler2D* sampler ) {
+
+  usage = 0;
+  map<Image*, Entry>::iterator i;
+  for ( i = entries.begin(); i != entries.end(); ++i ) {
+    if ( i->second.state != INSTALLED ) continue;
+    Texture& tex = i->first->tex;
+    tex.mipmap.resize( 1 );
+    sampler->generate_mips( tex, 0 );
+    i->second.sampler = sampler;
+    i->second.bytes = texture_bytes( tex );
+    usage += i->second.bytes;
+  }
+}
+
+void ImageLoader::clear() {
+
+  {
+    unique_lock<std::mutex> lock( mutex );
+    queue.clear();
+    done.wait( lock, [this] { return !busy; } );
+    decoded.clear();
+  }
+  taken.clear();
+
+  map<Image*, Entry>::iterator i;
+  for ( i = entries.begin(); i != entries.end(); ++i ) {
+    if ( i->second.state == INSTALLED ) placeholder( i->first->tex );
+  }
+  entries.clear();
+  evicting.clear();
+  usage = 0;
+}
+
+// least recently seen first
+static bool seen_before( const pair<size_t, Image*>& a,
+                         const pair<size_t, Image*>& b ) {
+  return a.first < b.first;
+}
+
+void ImageLoader::pick_evictions() {
+
+  // usage once the taken textures are in
+  size_t projected = usage;
+  for ( size_t i = 0; i < taken.size(); ++i ) {
+    if ( taken[i].ok ) projected += texture_bytes( taken[i].tex );
+  }
+
+  // installed textures out of view, least recently seen first
+  vector<pair<size_t, Image*> > candidates;
+  map<Image*, Entry>::iterator i;
+  for ( i = entries.begin(); i != entries.end(); ++i ) {
+    if ( i->second.state == INSTALLED && i->second.last_seen < requests ) {
+      candidates.push_back( make_pair( i->second.last_seen, i->first ) );
+    }
+  }
+  stable_sort( candidates.begin(), candidates.end(), seen_before );
+
+  evicting.clear();
+  for ( size_t j = 0; j < candidates.size() && projected > budget; ++j ) {
+    evicting.push_back( candidates[j].second );
+    projected -= entries[candidates[j].second].bytes;
+  }
+}
+
+void ImageLoader::run() {
+
+  unique_lock<std::mutex> lock( mutex );
+  while ( true ) {
+
+    wake.wait( lock, [this] { return stopping || !queue.empty(); } );
+    if ( stopping ) return;
+
+    Decoded d;
+    d.job = queue.front();
+    queue.pop_front();
+    busy = true;
+    lock.unlock();
+
+    d.ok = decode( *d.job.image, d.job.sampler, d.tex );
+
+    lock.lock();
+    decoded.resize( decoded.size() + 1 );
+    Decoded& out = decoded.back();
+    out.job = d.job;
+    out.ok = d.ok;
+    out.tex.width = d.tex.width;
+    out.tex.height = d.tex.height;
+    out.tex.mipmap.swap( d.tex.mipmap );
+    busy = false;
+    done.notify_all();
+  }
+}
+
+} // namespace CMU462
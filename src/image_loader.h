@@ -0,0 +1,156 @@
+#ifndef CMU462_IMAGE_LOADER_H
+#define CMU462_IMAGE_LOADER_H
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "CMU462.h"
+#include "svg.h"
+#include "texture.h"
+#include "svg_bvh.h"
+
+namespace CMU462 {
+
+// Default memory budget (in bytes) of decoded images
+static const size_t kImageBudget = 256 << 20;
+
+/**
+ * Decodes the textures of images on demand. Parsing only keeps the png
+ * file of an image and gives it a placeholder texture; the first time the
+ * image is in view its png is decoded and its mipmap generated on a
+ * thread of its own, and the texture is swapped in once done. Decoded
+ * textures are accounted against a memory budget, and the least recently
+ * seen ones that are out of view are dropped (back to the placeholder)
+ * when they exceed it, to be decoded again when seen. Textures only
+ * change in install and clear, which must not run while images are
+ * drawn; the thread only reads the png files of images.
+ */
+class ImageLoader {
+ public:
+
+  // where an image is drawn: its document and bounds in svg coordinates
+  struct Region {
+    SVG* svg;
+    BBox2D bounds;
+  };
+
+  ImageLoader( size_t budget = kImageBudget );
+
+  // stops the thread, after the image being decoded
+  ~ImageLoader( );
+
+  // Queue the images of svg that are in view (of a width x height window
+  // under svg_2_screen) and not decoded yet, to be decoded with mipmaps of
+  // sampler, and mark all images in view as used. The display list of svg
+  // must be compiled.
+  void request_visible( SVG& svg, const Matrix3x3& svg_2_screen,
+                        size_t width, size_t height, Sampler2D* sampler );
+
+  // true if images were decoded since the last install
+  bool has_decoded();
+
+  // Take the images decoded so far, to be swapped in by the next
+  // install, and pick the textures it drops to fit the budget. Adds the
+  // regions of all images whose texture the next install changes.
+  void take_decoded( std::vector<Region>& regions );
+
+  // Swap the textures taken by take_decoded into their images
+  // (regenerating the mipmaps if the sampler changed since they were
+  // queued), and drop the ones picked. Returns true if a texture changed.
+  bool install( Sampler2D* sampler );
+
+  // regenerate the mipmaps of all decoded textures with sampler
+  void regenerate( Sampler2D* sampler );
+
+  // Drop queued and decoded images, waiting for the one being decoded,
+  // and put the placeholder back into all images.
+  void clear();
+
+  // change the memory budget, textures over it are dropped by the next
+  // install
+  inline void set_budget( size_t budget ) {
+    this->budget = budget;
+  }
+
+  // bytes of decoded textures, mipmaps included
+  inline size_t memory_usage() const {
+    return usage;
+  }
+
+  // Decode the texture of image to tex, with mipmaps of sampler unless it
+  // is NULL. Returns false if the png could not be decoded.
+  static bool decode( const Image& image, Sampler2D* sampler, Texture& tex );
+
+  // Decode the images of svg in view right away, as request_visible would
+  // queue them. For renderers that do not show anything before the end.
+  static void load_visible( SVG& svg, const Matrix3x3& svg_2_screen,
+                            size_t width, size_t height, Sampler2D* sampler );
+
+  // make tex the 1x1 texture images have until they are decoded
+  static void placeholder( Texture& tex );
+
+ private:
+
+  struct Job {
+    Image* image;
+    Sampler2D* sampler;
+  };
+
+  struct Decoded {
+    Job job;
+    bool ok;
+    Texture tex;
+  };
+
+  // images seen by request_visible, by state
+  enum State { QUEUED, INSTALLED, FAILED };
+  struct Entry {
+    State state;
+    size_t last_seen;  // request_visible call that last saw it in view
+    size_t bytes;      // of its texture once installed
+    Sampler2D* sampler;
+    Region region;
+  };
+
+  // the images of svg that are in view and their bounds in svg coordinates
+  static void visible( SVG& svg, const Matrix3x3& svg_2_screen,
+                       size_t width, size_t height,
+                       std::vector<Image*>& images,
+                       std::vector<BBox2D>& bounds );
+
+  // pick the least recently seen textures out of view that leave the
+  // rest (and the taken ones) within the budget
+  void pick_evictions();
+
+  // thread main loop
+  void run();
+
+  size_t budget, usage;
+
+  // bookkeeping of the UI thread, and the number of request_visible calls
+  std::map<Image*, Entry> entries;
+  size_t requests;
+
+  // images to decode, in order, and decoded ones not taken yet
+  std::deque<Job> queue;
+  std::vector<Decoded> decoded;
+  bool busy;
+
+  // decoded images taken for the next install, and the ones it drops
+  std::vector<Decoded> taken;
+  std::vector<Image*> evicting;
+
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::thread thread;
+
+}; // class ImageLoader
+
+} // namespace CMU462
+
+#endif // CMU462_IMAGE_LOADER_H
@@ -1,9 +1,12 @@
 #include "CMU462.h"
 #include "viewer.h"
 #include "drawsvg.h"
+#include "batch_renderer.h"
 
 #include <sys/stat.h>
 #include <dirent.h>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 
 using namespace std;
@@ -88,8 +91,63 @@ int loadPath( DrawSVG* drawsvg, const char* path) {
   return -1;
 }
 
+#define batchUsage() msg("Usage: drawsvg --render <svg files or directories> " \
+                       "[--size WxH] [--samples N] [--threads N] " \
+                       "[--compression store|fast|best] " \
+                       "[-o <png file or directory>]")
+
+int renderBatch( int argc, char** argv ) {
+
+  BatchRenderer batch;
+  for (int i = 2; i < argc; ++i) {
+
+    const char* arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (!strcmp(arg, "--size") && has_value) {
+      unsigned w, h;
+      if (sscanf(argv[++i], "%ux%u", &w, &h) != 2 || !w || !h) {
+        batchUsage(); return 1;
+      }
+      batch.set_size(w, h);
+    } else if (!strcmp(arg, "--samples") && has_value) {
+      int rate = atoi(argv[++i]);
+      if (rate < 1 || rate > 8) {
+        msg("Samples (per pixel side) must be 1 to 8"); return 1;
+      }
+      batch.set_sample_rate(rate);
+    } else if (!strcmp(arg, "--threads") && has_value) {
+      int threads = atoi(argv[++i]);
+      if (threads < 1) { batchUsage(); return 1; }
+      batch.set_threads(threads);
+    } else if (!strcmp(arg, "--compression") && has_value) {
+      const char* effort = argv[++i];
+      if (!strcmp(effort, "store")) batch.set_compression(PNG_STORE);
+      else if (!strcmp(effort, "fast")) batch.set_compression(PNG_FAST);
+      else if (!strcmp(effort, "best")) batch.set_compression(PNG_BEST);
+      else { batchUsage(); return 1; }
+    } else if (!strcmp(arg, "-o") && has_value) {
+      batch.set_output(argv[++i]);
+    } else if (arg[0] == '-') {
+      batchUsage(); return 1;
+    } else if (batch.add(arg) < 0) {
+      msg("Invalid path: " << arg); return 1;
+    }
+  }
+
+  if (!batch.file_count()) {
+    batchUsage(); return 1;
+  }
+
+  return batch.run() ? 1 : 0;
+}
+
 int main( int argc, char** argv ) {
 
+  // render to png files, without a window
+  if( argc > 1 && !strcmp(argv[1], "--render") ) {
+    return renderBatch(argc, argv);
+  }
+
   // create viewer
   Viewer viewer = Viewer();
 
@@ -103,7 +161,8 @@ int main( int argc, char** argv ) {
   if( argc == 2 ) {
     if (loadPath(drawsvg, argv[1]) < 0) exit(0);
   } else {
-    msg("Usage: drawsvg <path to test file or directory>"); exit(0);
+    msg("Usage: drawsvg <path to test file or directory>");
+    batchUsage(); exit(0);
   }
 
   // init viewer
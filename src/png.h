@@ -10,6 +10,13 @@
 
 namespace CMU462 {
 
+// Compression effort of saved PNGs: stored (not compressed), fast or best
+enum PNGCompression {
+  PNG_STORE,
+  PNG_FAST,
+  PNG_BEST
+};
+
 struct PNG {
   int width;
   int height;
@@ -20,7 +27,10 @@ class PNGParser {
  public:
   static int load( const unsigned char* buffer, size_t size, PNG& png );
   static int load( const char* filename, PNG& png );
-  static int save( const char* filename, const PNG& png );
+  static int save( const char* filename, const PNG& png,
+                   PNGCompression compression = PNG_FAST );
+  static int save( const PNG& png, std::vector<unsigned char>& buffer,
+                   PNGCompression compression = PNG_FAST );
 }; // class PNGParser
 
 } // namespace CMU462
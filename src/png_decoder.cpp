@@ -0,0 +1,861 @@
+#include "png_decoder.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DRAWSVG_X86
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+// Inflate //
+
+// Codes of up to this many bits are decoded by a single table lookup
+static const int kFastBits = 10;
+
+static const uint16_t kLengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t kLengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t kDistBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577 };
+static const uint8_t kDistExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t kCodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// the lowest 16 bits of x, reversed
+static inline unsigned reverse16( unsigned x ) {
+  x = ((x & 0xaaaa) >> 1) | ((x & 0x5555) << 1);
+  x = ((x & 0xcccc) >> 2) | ((x & 0x3333) << 2);
+  x = ((x & 0xf0f0) >> 4) | ((x & 0x0f0f) << 4);
+  return ((x & 0xff00) >> 8) | ((x & 0x00ff) << 8);
+}
+
+static inline uint64_t load64( const unsigned char* p ) {
+  uint64_t v;
+  memcpy( &v, p, 8 );
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64( v );
+#endif
+  return v;
+}
+
+#ifdef DRAWSVG_X86
+static inline uint32_t sum_epi32( __m128i v ) {
+  v = _mm_add_epi32( v, _mm_shuffle_epi32( v, 0x4e ) );
+  v = _mm_add_epi32( v, _mm_shuffle_epi32( v, 0xb1 ) );
+  return _mm_cvtsi128_si32( v );
+}
+#endif
+
+static uint32_t adler32( const unsigned char* data, size_t size ) {
+  uint32_t a = 1, b = 0;
+  while ( size ) {
+
+    // sums stay in 32 bits for 5552 bytes
+    size_t n = min( size, (size_t) 5552 );
+    size -= n;
+
+#ifdef DRAWSVG_X86
+    // 16 bytes at a time: a gains their sum, b gains 16 times a before
+    // them plus their sum weighted from 16 down to 1
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights_lo = _mm_set_epi16( 9, 10, 11, 12, 13, 14, 15, 16 );
+    const __m128i weights_hi = _mm_set_epi16( 1, 2, 3, 4, 5, 6, 7, 8 );
+    __m128i sums = zero, prefix = zero, weighted = zero;
+    size_t blocks = n / 16;
+    for ( size_t i = 0; i < blocks; ++i, data += 16 ) {
+      __m128i x = _mm_loadu_si128( (const __m128i*) data );
+      prefix = _mm_add_epi32( prefix, sums );
+      sums = _mm_add_epi32( sums, _mm_sad_epu8( x, zero ) );
+      weighted = _mm_add_epi32( weighted, _mm_add_epi32(
+        _mm_madd_epi16( _mm_unpacklo_epi8( x, zero ), weights_lo ),
+        _mm_madd_epi16( _mm_unpackhi_epi8( x, zero ), weights_hi ) ) );
+    }
+    uint64_t b64 = b + 16 * ((uint64_t) a * blocks + sum_epi32( prefix )) +
+                   sum_epi32( weighted );
+    a += sum_epi32( sums );
+    b = b64 % 65521;
+    n -= 16 * blocks;
+#endif
+
+    while ( n-- ) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return b << 16 | a;
+}
+
+/**
+ * Canonical Huffman code. Codes of up to kFastBits bits are looked up in
+ * a table indexed by the next bits of the stream; longer ones are found
+ * by comparing the next 16 bits (in code order) with the first code after
+ * those of each length.
+ */
+struct Huffman {
+
+  // length << 9 | symbol, 0 for longer (or invalid) codes
+  uint16_t fast[1 << kFastBits];
+
+  // first code after those of each length, aligned to 16 bits
+  uint32_t limit[16];
+
+  // index in symbols of the codes of each length, less their first code
+  int offset[16];
+
+  // symbols in code order
+  uint16_t symbols[288];
+
+  // false if the lengths oversubscribe the code space
+  bool build( const uint8_t* lengths, int n ) {
+
+    int count[16] = { 0 };
+    for ( int i = 0; i < n; ++i ) count[lengths[i]]++;
+    count[0] = 0;
+
+    int left = 1;
+    for ( int len = 1; len < 16; ++len ) {
+      left = (left << 1) - count[len];
+      if ( left < 0 ) return false;
+    }
+
+    int next[16];
+    for ( int len = 1, code = 0, index = 0; len < 16; ++len ) {
+      next[len] = index;
+      offset[len] = index - code;
+      limit[len] = (uint32_t) (code + count[len]) << (16 - len);
+      code = (code + count[len]) << 1;
+      index += count[len];
+    }
+
+    memset( fast, 0, sizeof(fast) );
+    for ( int sym = 0; sym < n; ++sym ) {
+      int len = lengths[sym];
+      if ( !len ) continue;
+      int code = next[len] - offset[len];
+      symbols[next[len]++] = sym;
+      if ( len > kFastBits ) continue;
+
+      // every index whose lowest len bits are the code, in stream order
+      unsigned rev = reverse16( code ) >> (16 - len);
+      for ( unsigned j = rev; j < (1u << kFastBits); j += 1u << len ) {
+        fast[j] = (len << 9) | sym;
+      }
+    }
+    return true;
+  }
+};
+
+// fixed codes of block type 1
+struct FixedCodes {
+
+  Huffman lit, dist;
+
+  FixedCodes() {
+    uint8_t lengths[288];
+    memset( lengths, 8, 144 );
+    memset( lengths + 144, 9, 112 );
+    memset( lengths + 256, 7, 24 );
+    memset( lengths + 280, 8, 8 );
+    lit.build( lengths, 288 );
+    memset( lengths, 5, 30 );
+    dist.build( lengths, 30 );
+  }
+};
+
+/**
+ * Inflates a zlib stream into a buffer of the exact size of the data.
+ * The bit buffer holds at least 56 bits after a refill, enough for a
+ * length and distance pair with their extra bits; past the end of the
+ * input it is filled with zeros, and reading them is an error.
+ */
+class Inflater {
+ public:
+
+  // out has room for size + 8 bytes, so matches can be copied 8 at a time
+  Inflater( const unsigned char* in, size_t in_size,
+            unsigned char* out, size_t size )
+    : in (in), in_size (in_size), pos (0), bits (0), count (0),
+      out (out), out_size (size), out_pos (0) { }
+
+  int inflate() {
+
+    if ( in_size < 2 ) return 53;
+    if ( (in[0] * 256 + in[1]) % 31 != 0 ) return 24;
+    if ( (in[0] & 15) != 8 || (in[0] >> 4) > 7 ) return 25;
+    if ( in[1] & 32 ) return 26;
+    pos = 2;
+
+    static const FixedCodes fixed;
+    bool final = false;
+    while ( !final ) {
+
+      refill();
+      final = bits & 1;
+      int type = (bits >> 1) & 3;
+      take( 3 );
+
+      int error = 0;
+      if ( type == 0 ) {
+        error = stored();
+      } else if ( type == 1 ) {
+        error = block( fixed.lit, fixed.dist );
+      } else if ( type == 2 ) {
+        error = read_codes();
+        if ( !error ) error = block( dynamic_lit, dynamic_dist );
+      } else {
+        error = 20;
+      }
+      if ( error ) return error;
+      if ( overrun() ) return 52;
+    }
+
+    if ( out_pos != out_size ) return 91;
+
+    // the Adler-32 of the data follows, from the next byte
+    size_t p = pos - (count >> 3);
+    if ( p + 4 > in_size ) return 52;
+    uint32_t adler = (uint32_t) in[p] << 24 | in[p + 1] << 16 |
+                     in[p + 2] << 8 | in[p + 3];
+    if ( adler != adler32( out, out_size ) ) return 58;
+    return 0;
+  }
+
+ private:
+
+  inline void refill() {
+    if ( pos + 8 <= in_size ) {
+      // the bits above count are either zero or the ones read again
+      bits |= load64( in + pos ) << count;
+      pos += (63 - count) >> 3;
+      count |= 56;
+    } else {
+      while ( count <= 56 ) {
+        bits |= (uint64_t) (pos < in_size ? in[pos] : 0) << count;
+        ++pos;
+        count += 8;
+      }
+    }
+  }
+
+  // true once bits past the end of the input were taken
+  inline bool overrun() const {
+    return pos > in_size && (pos - in_size) * 8 > (size_t) count;
+  }
+
+  inline unsigned take( int n ) {
+    unsigned v = (unsigned) bits & ((1u << n) - 1);
+    bits >>= n;
+    count -= n;
+    return v;
+  }
+
+  // next symbol of code h, -1 if the bits are not a code
+  inline int decode( const Huffman& h ) {
+    unsigned e = h.fast[bits & ((1 << kFastBits) - 1)];
+    if ( e ) {
+      take( e >> 9 );
+      return e & 511;
+    }
+    unsigned k = reverse16( (unsigned) bits );
+    int len = kFastBits + 1;
+    while ( len < 16 && k >= h.limit[len] ) ++len;
+    if ( len == 16 ) return -1;
+    take( len );
+    return h.symbols[(k >> (16 - len)) + h.offset[len]];
+  }
+
+  int stored() {
+
+    // from the next byte boundary
+    take( count & 7 );
+    size_t p = pos - (count >> 3);
+    bits = 0;
+    count = 0;
+
+    if ( p + 4 > in_size ) return 52;
+    size_t len = in[p] | in[p + 1] << 8;
+    size_t nlen = in[p + 2] | in[p + 3] << 8;
+    if ( len + nlen != 65535 ) return 21;
+    p += 4;
+    if ( p + len > in_size ) return 23;
+    if ( len > out_size - out_pos ) return 91;
+
+    memcpy( out + out_pos, in + p, len );
+    out_pos += len;
+    pos = p + len;
+    return 0;
+  }
+
+  // the codes of a dynamic block
+  int read_codes() {
+
+    refill();
+    int hlit = take( 5 ) + 257;
+    int hdist = take( 5 ) + 1;
+    int hclen = take( 4 ) + 4;
+
+    uint8_t lengths[288 + 32] = { 0 };
+    for ( int i = 0; i < hclen; ++i ) {
+      refill();
+      lengths[kCodeLengthOrder[i]] = take( 3 );
+    }
+    Huffman codes;
+    if ( !codes.build( lengths, 19 ) ) return 55;
+
+    int n = hlit + hdist;
+    memset( lengths, 0, sizeof(lengths) );
+    for ( int i = 0; i < n; ) {
+      if ( overrun() ) return 50;
+      refill();
+      int sym = decode( codes );
+      if ( sym < 0 ) return 16;
+      if ( sym < 16 ) {
+        lengths[i++] = sym;
+        continue;
+      }
+
+      int repeat;
+      uint8_t value = 0;
+      if ( sym == 16 ) {
+        if ( i == 0 ) return 54;
+        value = lengths[i - 1];
+        repeat = 3 + take( 2 );
+      } else if ( sym == 17 ) {
+        repeat = 3 + take( 3 );
+      } else {
+        repeat = 11 + take( 7 );
+      }
+      if ( i + repeat > n ) return 13;
+      memset( lengths + i, value, repeat );
+      i += repeat;
+    }
+
+    if ( lengths[256] == 0 ) return 64;
+    if ( !dynamic_lit.build( lengths, hlit ) ) return 55;
+    if ( !dynamic_dist.build( lengths + hlit, hdist ) ) return 55;
+    return 0;
+  }
+
+  // the symbols of a compressed block, up to its end code
+  int block( const Huffman& lit, const Huffman& dist ) {
+
+    while ( true ) {
+
+      if ( overrun() ) return 51;
+      refill();
+
+      int sym = decode( lit );
+      if ( sym < 256 ) {
+        if ( sym < 0 ) return 11;
+        if ( out_pos == out_size ) return 91;
+        out[out_pos++] = sym;
+        continue;
+      }
+      if ( sym == 256 ) return 0;
+
+      sym -= 257;
+      if ( sym >= 29 ) return 11;
+      size_t len = kLengthBase[sym] + take( kLengthExtra[sym] );
+      int dsym = decode( dist );
+      if ( dsym < 0 ) return 11;
+      if ( dsym >= 30 ) return 18;
+      size_t d = kDistBase[dsym] + take( kDistExtra[dsym] );
+      if ( d > out_pos ) return 52;
+      if ( len > out_size - out_pos ) return 91;
+
+      unsigned char* dst = out + out_pos;
+      const unsigned char* src = dst - d;
+      out_pos += len;
+      if ( d >= 8 ) {
+        // may write up to 7 bytes past the match, into the slack
+        for ( size_t i = 0; i < len; i += 8 ) memcpy( dst + i, src + i, 8 );
+      } else if ( d == 1 ) {
+        memset( dst, *src, len );
+      } else {
+        for ( size_t i = 0; i < len; ++i ) dst[i] = src[i];
+      }
+    }
+  }
+
+  const unsigned char* in;
+  size_t in_size, pos;
+  uint64_t bits;
+  int count;
+
+  unsigned char* out;
+  size_t out_size, out_pos;
+
+  Huffman dynamic_lit, dynamic_dist;
+};
+
+// Unfilter //
+
+static inline unsigned char paeth( int a, int b, int c ) {
+  int p = a + b - c;
+  int pa = abs( p - a ), pb = abs( p - b ), pc = abs( p - c );
+  return (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+}
+
+// unfilter a row of n bytes in place, prev is the previous row unfiltered
+// (zeros for the first row), bpp the bytes per complete pixel
+static void unfilter_scalar( unsigned char* row, const unsigned char* prev,
+                             size_t n, size_t bpp, int type ) {
+  switch ( type ) {
+    case 1:
+      for ( size_t i = bpp; i < n; ++i ) row[i] += row[i - bpp];
+      break;
+    case 2:
+      for ( size_t i = 0; i < n; ++i ) row[i] += prev[i];
+      break;
+    case 3:
+      for ( size_t i = 0; i < bpp; ++i ) row[i] += prev[i] >> 1;
+      for ( size_t i = bpp; i < n; ++i ) {
+        row[i] += (row[i - bpp] + prev[i]) >> 1;
+      }
+      break;
+    case 4:
+      for ( size_t i = 0; i < bpp; ++i ) row[i] += prev[i];
+      for ( size_t i = bpp; i < n; ++i ) {
+        row[i] += paeth( row[i - bpp], prev[i], prev[i - bpp] );
+      }
+      break;
+  }
+}
+
+#ifdef DRAWSVG_X86
+
+// SSE2 //
+
+// A pixel of 3 or 4 bytes in the low lane. Sub, Average and Paeth depend
+// on the pixel to the left, so rows are unfiltered a pixel at a time, all
+// of its bytes at once. (3 byte pixels are assembled in registers, a
+// memcpy of 3 bytes goes through the stack.)
+template <int bpp>
+static inline __m128i load_pixel( const unsigned char* p ) {
+  uint32_t v;
+  if ( bpp == 4 ) {
+    memcpy( &v, p, 4 );
+  } else {
+    uint16_t lo;
+    memcpy( &lo, p, 2 );
+    v = lo | (uint32_t) p[2] << 16;
+  }
+  return _mm_cvtsi32_si128( v );
+}
+
+template <int bpp>
+static inline void store_pixel( unsigned char* p, __m128i v ) {
+  uint32_t x = _mm_cvtsi128_si32( v );
+  if ( bpp == 4 ) {
+    memcpy( p, &x, 4 );
+  } else {
+    uint16_t lo = x;
+    memcpy( p, &lo, 2 );
+    p[2] = x >> 16;
+  }
+}
+
+static void unfilter_up_sse2( unsigned char* row, const unsigned char* prev,
+                              size_t n ) {
+  size_t i = 0;
+  for ( ; i + 16 <= n; i += 16 ) {
+    __m128i x = _mm_loadu_si128( (const __m128i*) (row + i) );
+    __m128i b = _mm_loadu_si128( (const __m128i*) (prev + i) );
+    _mm_storeu_si128( (__m128i*) (row + i), _mm_add_epi8( x, b ) );
+  }
+  for ( ; i < n; ++i ) row[i] += prev[i];
+}
+
+template <int bpp>
+static void unfilter_sub_sse2( unsigned char* row, size_t n ) {
+  __m128i a = _mm_setzero_si128();
+  size_t i = 0;
+  if ( bpp == 4 ) {
+    // prefix sums of 4 pixels, plus the last pixel before them
+    for ( ; i + 16 <= n; i += 16 ) {
+      __m128i x = _mm_loadu_si128( (const __m128i*) (row + i) );
+      x = _mm_add_epi8( x, _mm_slli_si128( x, 4 ) );
+      x = _mm_add_epi8( x, _mm_slli_si128( x, 8 ) );
+      x = _mm_add_epi8( x, a );
+      _mm_storeu_si128( (__m128i*) (row + i), x );
+      a = _mm_shuffle_epi32( x, 0xff );
+    }
+  }
+  for ( ; i < n; i += bpp ) {
+    a = _mm_add_epi8( a, load_pixel<bpp>( row + i ) );
+    store_pixel<bpp>( row + i, a );
+  }
+}
+
+template <int bpp>
+static void unfilter_avg_sse2( unsigned char* row, const unsigned char* prev,
+                               size_t n ) {
+  // (a + b) >> 1 is the rounded up average less the lowest bit of a ^ b
+  const __m128i one = _mm_set1_epi8( 1 );
+  __m128i a = _mm_setzero_si128();
+  for ( size_t i = 0; i < n; i += bpp ) {
+    __m128i b = load_pixel<bpp>( prev + i );
+    __m128i avg = _mm_sub_epi8( _mm_avg_epu8( a, b ),
+                                _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+    a = _mm_add_epi8( load_pixel<bpp>( row + i ), avg );
+    store_pixel<bpp>( row + i, a );
+  }
+}
+
+static inline __m128i abs_epi16( __m128i x ) {
+  return _mm_max_epi16( x, _mm_sub_epi16( _mm_setzero_si128(), x ) );
+}
+
+static inline __m128i choose( __m128i mask, __m128i a, __m128i b ) {
+  return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+template <int bpp>
+static void unfilter_paeth_sse2( unsigned char* row, const unsigned char* prev,
+                                 size_t n ) {
+  // in 16 bits: p - a = b - c, p - b = a - c and p - c is their sum
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for ( size_t i = 0; i < n; i += bpp ) {
+    __m128i b = _mm_unpacklo_epi8( load_pixel<bpp>( prev + i ), zero );
+    __m128i pa = _mm_sub_epi16( b, c );
+    __m128i pb = _mm_sub_epi16( a, c );
+    __m128i pc = abs_epi16( _mm_add_epi16( pa, pb ) );
+    pa = abs_epi16( pa );
+    pb = abs_epi16( pb );
+    __m128i least = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+    __m128i pred = choose( _mm_cmpeq_epi16( least, pa ), a,
+                   choose( _mm_cmpeq_epi16( least, pb ), b, c ) );
+    __m128i x = _mm_add_epi8( load_pixel<bpp>( row + i ),
+                              _mm_packus_epi16( pred, pred ) );
+    store_pixel<bpp>( row + i, x );
+    a = _mm_unpacklo_epi8( x, zero );
+    c = b;
+  }
+}
+
+template <int bpp>
+static void unfilter_sse2( unsigned char* row, const unsigned char* prev,
+                           size_t n, int type ) {
+  switch ( type ) {
+    case 1: unfilter_sub_sse2<bpp>( row, n ); break;
+    case 2: unfilter_up_sse2( row, prev, n ); break;
+    case 3: unfilter_avg_sse2<bpp>( row, prev, n ); break;
+    case 4: unfilter_paeth_sse2<bpp>( row, prev, n ); break;
+  }
+}
+
+#endif // DRAWSVG_X86
+
+// SSE2 unfiltering, unless DRAWSVG_SIMD asks for the scalar kernels
+static bool unfilter_simd() {
+#ifdef DRAWSVG_X86
+  static const bool simd = !getenv( "DRAWSVG_SIMD" ) ||
+                           string( getenv( "DRAWSVG_SIMD" ) ) != "scalar";
+  return simd;
+#else
+  return false;
+#endif
+}
+
+// Unfilter a row in place, false if the filter type is invalid
+static bool unfilter( unsigned char* row, const unsigned char* prev,
+                      size_t n, size_t bpp, int type ) {
+  if ( type > 4 ) return false;
+  if ( type == 0 ) return true;
+#ifdef DRAWSVG_X86
+  if ( unfilter_simd() ) {
+    if ( bpp == 3 ) {
+      unfilter_sse2<3>( row, prev, n, type );
+      return true;
+    }
+    if ( bpp == 4 ) {
+      unfilter_sse2<4>( row, prev, n, type );
+      return true;
+    }
+    if ( type == 2 ) {
+      unfilter_up_sse2( row, prev, n );
+      return true;
+    }
+  }
+#endif
+  unfilter_scalar( row, prev, n, bpp, type );
+  return true;
+}
+
+// Decoder //
+
+static inline size_t read32( const unsigned char* p ) {
+  return (size_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline unsigned read16( const unsigned char* p ) {
+  return p[0] << 8 | p[1];
+}
+
+PNGDecoder::PNGDecoder( const unsigned char* buffer, size_t size )
+  : width (0), height (0), bit_depth (0), color_type (0), interlace (0),
+    bits_per_pixel (0), palette_size (0), key_defined (false),
+    zlib (NULL), zlib_size (0) {
+
+  error = read_chunks( buffer, size );
+  if ( error ) width = height = 0;
+}
+
+int PNGDecoder::read_chunks( const unsigned char* in, size_t size ) {
+
+  if ( size == 0 || in == NULL ) return 48;
+  if ( size < 29 ) return 27;
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  if ( memcmp( in, signature, 8 ) ) return 28;
+  if ( memcmp( in + 12, "IHDR", 4 ) ) return 29;
+
+  width = read32( in + 16 );
+  height = read32( in + 20 );
+  bit_depth = in[24];
+  color_type = in[25];
+  if ( in[26] != 0 ) return 32;
+  if ( in[27] != 0 ) return 33;
+  if ( in[28] > 1 ) return 34;
+  interlace = in[28];
+
+  int d = bit_depth;
+  switch ( color_type ) {
+    case 0: if ( d != 1 && d != 2 && d != 4 && d != 8 && d != 16 ) return 37;
+            break;
+    case 3: if ( d != 1 && d != 2 && d != 4 && d != 8 ) return 37;
+            break;
+    case 2: case 4: case 6: if ( d != 8 && d != 16 ) return 37;
+            break;
+    default: return 31;
+  }
+  static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+  bits_per_pixel = channels[color_type] * bit_depth;
+
+  // the image must fit in memory as RGBA
+  if ( width == 0 || height == 0 ) return 93;
+  if ( width > (1u << 30) / height ) return 92;
+
+  // chunks, up to IEND, skipping those that are not needed
+  size_t pos = 33, chunks = 0;
+  while ( true ) {
+
+    if ( pos + 12 > size ) return 30;
+    size_t length = read32( in + pos );
+    if ( length > 2147483647 ) return 63;
+    if ( pos + 12 + length > size ) return 35;
+    const unsigned char* type = in + pos + 4;
+    const unsigned char* data = in + pos + 8;
+    pos += 12 + length;
+
+    if ( !memcmp( type, "IDAT", 4 ) ) {
+      if ( chunks++ == 0 ) {
+        zlib = data;
+      } else {
+        if ( chunks == 2 ) idat.assign( zlib, zlib + zlib_size );
+        idat.insert( idat.end(), data, data + length );
+      }
+      zlib_size += length;
+    } else if ( !memcmp( type, "IEND", 4 ) ) {
+      break;
+    } else if ( !memcmp( type, "PLTE", 4 ) ) {
+      palette_size = length / 3;
+      if ( palette_size > 256 ) return 38;
+      for ( size_t i = 0; i < palette_size; ++i ) {
+        memcpy( palette + 4 * i, data + 3 * i, 3 );
+        palette[4 * i + 3] = 255;
+      }
+    } else if ( !memcmp( type, "tRNS", 4 ) ) {
+      if ( color_type == 3 ) {
+        if ( length > palette_size ) return 39;
+        for ( size_t i = 0; i < length; ++i ) palette[4 * i + 3] = data[i];
+      } else if ( color_type == 0 ) {
+        if ( length != 2 ) return 40;
+        key_defined = true;
+        key[0] = key[1] = key[2] = read16( data );
+      } else if ( color_type == 2 ) {
+        if ( length != 6 ) return 41;
+        key_defined = true;
+        for ( int c = 0; c < 3; ++c ) key[c] = read16( data + 2 * c );
+      } else {
+        return 42;
+      }
+    } else if ( !(type[0] & 32) ) {
+      return 69; // unknown critical chunk
+    }
+  }
+
+  for ( size_t i = 0; i < palette_size; ++i ) {
+    if ( !palette[4 * i + 3] ) memset( palette + 4 * i, 0, 3 );
+  }
+  if ( chunks > 1 ) zlib = NULL;
+  return 0;
+}
+
+int PNGDecoder::decode( vector<unsigned char>& pixels ) {
+
+  pixels.clear();
+  if ( error ) return error;
+
+  // Adam7 passes: first column and row, column and row spacing
+  static const int kPassX[7] = { 0, 4, 0, 2, 0, 1, 0 };
+  static const int kPassY[7] = { 0, 0, 4, 0, 2, 0, 1 };
+  static const int kPassDX[7] = { 8, 8, 4, 4, 2, 2, 1 };
+  static const int kPassDY[7] = { 8, 8, 8, 4, 4, 2, 2 };
+  int passes = interlace ? 7 : 1;
+  size_t pass_w[7], pass_h[7];
+  size_t raw_size = 0;
+  for ( int p = 0; p < passes; ++p ) {
+    size_t dx = interlace ? kPassDX[p] : 1, dy = interlace ? kPassDY[p] : 1;
+    size_t x0 = interlace ? kPassX[p] : 0, y0 = interlace ? kPassY[p] : 0;
+    pass_w[p] = width > x0 ? (width - x0 + dx - 1) / dx : 0;
+    pass_h[p] = height > y0 ? (height - y0 + dy - 1) / dy : 0;
+    if ( pass_w[p] && pass_h[p] ) {
+      raw_size += pass_h[p] * (1 + row_bytes( pass_w[p] ));
+    }
+  }
+
+  // deflate expands data at most 1032 times, a header claiming more is
+  // broken and would only allocate a lot of memory
+  if ( raw_size / 1032 > zlib_size ) return 91;
+
+  // filtered rows, with slack for copies of matches
+  vector<unsigned char> raw( raw_size + 8 );
+  const unsigned char* data = idat.empty() ? zlib : &idat[0];
+  Inflater inflater( data, zlib_size, &raw[0], raw_size );
+  int status = inflater.inflate();
+  if ( status ) return status;
+
+  pixels.resize( 4 * width * height );
+  size_t bpp = (bits_per_pixel + 7) / 8;
+  vector<unsigned char> zeros( row_bytes( width ), 0 );
+  vector<unsigned char> expanded( interlace ? 4 * width : 0 );
+
+  // unfilter each row in place and expand it right away
+  unsigned char* row = &raw[0];
+  for ( int p = 0; p < passes; ++p ) {
+    size_t w = pass_w[p], h = pass_h[p], n = row_bytes( w );
+    if ( !w || !h ) continue;
+    const unsigned char* prev = &zeros[0];
+    for ( size_t y = 0; y < h; ++y ) {
+
+      int type = row[0];
+      if ( !unfilter( row + 1, prev, n, bpp, type ) ) {
+        pixels.clear();
+        return 36;
+      }
+
+      if ( !interlace ) {
+        status = expand_row( &pixels[4 * width * y], row + 1, w );
+      } else {
+        status = expand_row( &expanded[0], row + 1, w );
+        unsigned char* dst = &pixels[4 * (width * (kPassY[p] + kPassDY[p] * y) +
+                                          kPassX[p])];
+        for ( size_t i = 0; i < w; ++i ) {
+          memcpy( dst + 4 * kPassDX[p] * i, &expanded[4 * i], 4 );
+        }
+      }
+      if ( status ) {
+        pixels.clear();
+        return status;
+      }
+
+      prev = row + 1;
+      row += 1 + n;
+    }
+  }
+  return 0;
+}
+
+int PNGDecoder::expand_row( unsigned char* out, const unsigned char* row,
+                            size_t n ) const {
+
+  int d = bit_depth;
+
+  // indexed, and grey below 8 bits
+  if ( d < 8 || color_type == 3 ) {
+    unsigned mask = (1 << d) - 1, scale = 255 / mask;
+    for ( size_t i = 0; i < n; ++i ) {
+      size_t bit = i * d;
+      unsigned v = d == 8 ? row[i] : (row[bit >> 3] >> (8 - d - (bit & 7))) & mask;
+      if ( color_type == 3 ) {
+        if ( v >= palette_size ) return d == 8 ? 46 : 47;
+        memcpy( out + 4 * i, palette + 4 * v, 4 );
+      } else if ( key_defined && v == key[0] ) {
+        memset( out + 4 * i, 0, 4 );
+      } else {
+        memset( out + 4 * i, v * scale, 3 );
+        out[4 * i + 3] = 255;
+      }
+    }
+    return 0;
+  }
+
+  // 8 or 16 bits per channel, keeping the high byte of 16
+  size_t step = d / 8;
+  switch ( color_type ) {
+    case 0:
+      for ( size_t i = 0; i < n; ++i ) {
+        const unsigned char* s = row + step * i;
+        unsigned v = step == 1 ? s[0] : read16( s );
+        if ( key_defined && v == key[0] ) {
+          memset( out + 4 * i, 0, 4 );
+        } else {
+          memset( out + 4 * i, s[0], 3 );
+          out[4 * i + 3] = 255;
+        }
+      }
+      break;
+    case 2:
+      for ( size_t i = 0; i < n; ++i ) {
+        const unsigned char* s = row + 3 * step * i;
+        unsigned char* o = out + 4 * i;
+        if ( key_defined && (step == 1 ?
+             s[0] == key[0] && s[1] == key[1] && s[2] == key[2] :
+             read16( s ) == key[0] && read16( s + 2 ) == key[1] &&
+             read16( s + 4 ) == key[2]) ) {
+          memset( o, 0, 4 );
+        } else {
+          o[0] = s[0]; o[1] = s[step]; o[2] = s[2 * step]; o[3] = 255;
+        }
+      }
+      break;
+    case 4:
+      for ( size_t i = 0; i < n; ++i ) {
+        const unsigned char* s = row + 2 * step * i;
+        unsigned char a = s[step];
+        memset( out + 4 * i, a ? s[0] : 0, 3 );
+        out[4 * i + 3] = a;
+      }
+      break;
+    case 6:
+      if ( step == 1 ) {
+        memcpy( out, row, 4 * n );
+      } else {
+        for ( size_t i = 0; i < 4 * n; ++i ) out[i] = row[2 * i];
+      }
+      for ( size_t i = 0; i < n; ++i ) {
+        if ( !out[4 * i + 3] ) memset( out + 4 * i, 0, 3 );
+      }
+      break;
+  }
+  return 0;
+}
+
+} // namespace CMU462
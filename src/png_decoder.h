@@ -0,0 +1,80 @@
+#ifndef CMU462_PNG_DECODER_H
+#define CMU462_PNG_DECODER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "png.h"
+
+namespace CMU462 {
+
+/**
+ * PNG decoder. The zlib stream of the image is inflated with a 64-bit bit
+ * buffer and Huffman codes decoded by table lookups of several bits at
+ * once, the rows are unfiltered in place (with SSE2 for 3 and 4 byte
+ * pixels unless DRAWSVG_SIMD is "scalar") and each row is expanded to
+ * RGBA8 right after, into the final pixel buffer. Fully transparent pixels
+ * are decoded as zero. Error codes are those of picoPNG/LodePNG.
+ */
+class PNGDecoder {
+ public:
+
+  // Read the header and the chunks of the png file in buffer, which must
+  // outlive the decoder.
+  PNGDecoder( const unsigned char* buffer, size_t size );
+
+  // 0 if the file could be read, else the error code
+  inline int status() const {
+    return error;
+  }
+
+  inline size_t get_width() const {
+    return width;
+  }
+
+  inline size_t get_height() const {
+    return height;
+  }
+
+  // Decode the image to 4 * width * height bytes of RGBA8 pixels. Returns
+  // 0, or the error code (and no pixels).
+  int decode( std::vector<unsigned char>& pixels );
+
+ private:
+
+  int read_chunks( const unsigned char* buffer, size_t size );
+
+  // expand n pixels of an unfiltered row to RGBA8
+  int expand_row( unsigned char* out, const unsigned char* row,
+                  size_t n ) const;
+
+  // bytes of a row of n pixels, without the filter type
+  inline size_t row_bytes( size_t n ) const {
+    return (n * bits_per_pixel + 7) / 8;
+  }
+
+  size_t width, height;
+  int bit_depth, color_type, interlace;
+  size_t bits_per_pixel;
+
+  // RGBA entries, transparent ones zeroed
+  unsigned char palette[4 * 256];
+  size_t palette_size;
+
+  // transparent color of grey and RGB images, at the image's bit depth
+  bool key_defined;
+  unsigned key[3];
+
+  // the zlib stream: the IDAT chunk itself if there is only one, else
+  // the concatenated chunks
+  const unsigned char* zlib;
+  size_t zlib_size;
+  std::vector<unsigned char> idat;
+
+  int error;
+
+}; // class PNGDecoder
+
+} // namespace CMU462
+
+#endif // CMU462_PNG_DECODER_H
@@ -0,0 +1,727 @@
+#include "png_encoder.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+// Bytes of filtered rows per band (at least a row)
+static const size_t kBandBytes = 256 << 10;
+
+// Deflate //
+
+static const int kWindowSize = 32768;
+static const int kHashBits = 15;
+static const int kMinMatch = 3;
+static const int kMaxMatch = 258;
+
+// Matches of the minimum length further back than this take more bits
+// than the literals
+static const int kTooFar = 4096;
+
+// Symbols per block, each block gets its own Huffman codes
+static const size_t kBlockSymbols = 1 << 15;
+
+static const uint16_t kLengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t kLengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t kDistBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577 };
+static const uint8_t kDistExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t kCodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// code lookups and the CRC table, built once
+struct Tables {
+
+  uint8_t length_code[kMaxMatch + 1];
+  uint8_t dist_code[512];
+  uint32_t crc[256];
+
+  Tables() {
+    for ( int l = kMinMatch, c = 0; l <= kMaxMatch; ++l ) {
+      while ( c < 28 && l >= kLengthBase[c + 1] ) ++c;
+      length_code[l] = c;
+    }
+    for ( int d = 0, c = 0; d < kWindowSize; ++d ) {
+      while ( c < 29 && d + 1 >= kDistBase[c + 1] ) ++c;
+      if ( d < 256 ) dist_code[d] = c;
+      else dist_code[256 + (d >> 7)] = c;
+    }
+    for ( uint32_t n = 0; n < 256; ++n ) {
+      uint32_t c = n;
+      for ( int k = 0; k < 8; ++k ) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      crc[n] = c;
+    }
+  }
+
+  // code of distance d (1 to kWindowSize)
+  inline int distance( int d ) const {
+    return d <= 256 ? dist_code[d - 1] : dist_code[256 + ((d - 1) >> 7)];
+  }
+};
+
+static const Tables& tables() {
+  static const Tables t;
+  return t;
+}
+
+static uint32_t adler32( const unsigned char* data, size_t size ) {
+  uint32_t a = 1, b = 0;
+  while ( size ) {
+    size_t n = min( size, (size_t) 5552 );
+    size -= n;
+    while ( n-- ) { a += *data++; b += a; }
+    a %= 65521; b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+// Adler-32 of the concatenation of data with checksum a1 and size2 bytes
+// with checksum a2
+static uint32_t adler32_combine( uint32_t a1, uint32_t a2, size_t size2 ) {
+  const uint32_t base = 65521;
+  uint32_t rem = size2 % base;
+  uint32_t sum1 = a1 & 0xffff;
+  uint32_t sum2 = (uint32_t) (((uint64_t) rem * sum1) % base);
+  sum1 += (a2 & 0xffff) + base - 1;
+  sum2 += (a1 >> 16) + (a2 >> 16) + base - rem;
+  if ( sum1 >= base ) sum1 -= base;
+  if ( sum1 >= base ) sum1 -= base;
+  if ( sum2 >= base << 1 ) sum2 -= base << 1;
+  if ( sum2 >= base ) sum2 -= base;
+  return (sum2 << 16) | sum1;
+}
+
+static uint32_t crc32( uint32_t crc, const unsigned char* data, size_t size ) {
+  const uint32_t* table = tables().crc;
+  crc = ~crc;
+  while ( size-- ) crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+// bits are packed from the least significant end of each byte
+struct BitWriter {
+
+  vector<unsigned char>& out;
+  uint64_t bits;
+  int count;
+
+  BitWriter( vector<unsigned char>& out ) : out (out), bits (0), count (0) { }
+
+  inline void put( uint32_t value, int n ) {
+    bits |= (uint64_t) value << count;
+    count += n;
+    while ( count >= 8 ) {
+      out.push_back( (unsigned char) bits );
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+
+  inline void align() {
+    if ( count ) out.push_back( (unsigned char) bits );
+    bits = 0;
+    count = 0;
+  }
+};
+
+// A literal (length 0) or a match of length bytes value bytes back
+struct Symbol {
+  uint16_t length;
+  uint16_t value;
+};
+
+// Code lengths (at most limit bits) of a Huffman code for the n symbols
+// with the given frequencies. The code is complete: symbols are added
+// until at least two have a code.
+static void huffman_lengths( const uint32_t* freq, int n, int limit,
+                             uint8_t* lengths ) {
+
+  vector<pair<uint32_t, int> > leaves;
+  for ( int i = 0; i < n; ++i ) {
+    if ( freq[i] ) leaves.push_back( make_pair( freq[i], i ) );
+  }
+  for ( int i = 0; leaves.size() < 2; ++i ) {
+    if ( !freq[i] ) leaves.push_back( make_pair( 1u, i ) );
+  }
+  sort( leaves.begin(), leaves.end() );
+
+  // Huffman tree of the sorted leaves with two queues: leaves and the
+  // inner nodes, which are made in order of weight
+  int m = leaves.size();
+  vector<uint64_t> weight( 2 * m - 1 );
+  vector<int> parent( 2 * m - 1 );
+  for ( int i = 0; i < m; ++i ) weight[i] = leaves[i].first;
+  int leaf = 0, inner = m;
+  for ( int node = m; node < 2 * m - 1; ++node ) {
+    for ( int k = 0; k < 2; ++k ) {
+      int i = leaf < m && (inner >= node || weight[leaf] <= weight[inner]) ?
+              leaf++ : inner++;
+      weight[node] += weight[i];
+      parent[i] = node;
+    }
+  }
+
+  // number of leaves at each depth, the deeper ones moved up to limit
+  // while keeping the code complete
+  vector<int> depth( 2 * m - 1, 0 );
+  vector<int> count( max( m, limit ) + 1, 0 );
+  for ( int i = 2 * m - 3; i >= 0; --i ) depth[i] = depth[parent[i]] + 1;
+  for ( int i = 0; i < m; ++i ) count[min( depth[i], limit )]++;
+  uint32_t total = 0;
+  for ( int d = 1; d <= limit; ++d ) total += count[d] << (limit - d);
+  while ( total > (1u << limit) ) {
+    count[limit]--;
+    for ( int d = limit - 1; d > 0; --d ) {
+      if ( count[d] ) {
+        count[d]--;
+        count[d + 1] += 2;
+        break;
+      }
+    }
+    total--;
+  }
+
+  // the longest codes go to the least frequent symbols
+  memset( lengths, 0, n );
+  int i = 0;
+  for ( int d = limit; d > 0; --d ) {
+    for ( int k = 0; k < count[d]; ++k ) lengths[leaves[i++].second] = d;
+  }
+}
+
+// canonical codes of the code lengths, bit reversed for BitWriter
+static void huffman_codes( const uint8_t* lengths, int n, uint16_t* codes ) {
+
+  int count[16] = { 0 }, next[16];
+  for ( int i = 0; i < n; ++i ) count[lengths[i]]++;
+  count[0] = 0;
+  for ( int bits = 1, code = 0; bits < 16; ++bits ) {
+    code = (code + count[bits - 1]) << 1;
+    next[bits] = code;
+  }
+  for ( int i = 0; i < n; ++i ) {
+    int len = lengths[i];
+    if ( !len ) continue;
+    int code = next[len]++, reversed = 0;
+    for ( int b = 0; b < len; ++b ) reversed |= ((code >> b) & 1) << (len - 1 - b);
+    codes[i] = reversed;
+  }
+}
+
+// stored blocks of data, the last one final if final is set
+static void write_stored( BitWriter& w, const unsigned char* data,
+                          size_t size, bool final ) {
+  size_t pos = 0;
+  do {
+    size_t n = min( size - pos, (size_t) 65535 );
+    w.put( final && pos + n == size ? 1 : 0, 1 );
+    w.put( 0, 2 );
+    w.align();
+    unsigned char header[4] = { (unsigned char) n, (unsigned char) (n >> 8),
+                                (unsigned char) ~n, (unsigned char) (~n >> 8) };
+    w.out.insert( w.out.end(), header, header + 4 );
+    w.out.insert( w.out.end(), data + pos, data + pos + n );
+    pos += n;
+  } while ( pos < size );
+}
+
+// Write a block of symbols, which encode the size bytes of data, as
+// stored, fixed or dynamic Huffman block, whichever is smallest.
+static void write_block( BitWriter& w, const vector<Symbol>& symbols,
+                         const unsigned char* data, size_t size,
+                         bool final ) {
+
+  const Tables& t = tables();
+  uint32_t lit_freq[286] = { 0 }, dist_freq[30] = { 0 };
+  uint64_t extra_bits = 0;
+  for ( size_t i = 0; i < symbols.size(); ++i ) {
+    const Symbol& s = symbols[i];
+    if ( !s.length ) {
+      lit_freq[s.value]++;
+      continue;
+    }
+    int lc = t.length_code[s.length], dc = t.distance( s.value );
+    lit_freq[257 + lc]++;
+    dist_freq[dc]++;
+    extra_bits += kLengthExtra[lc] + kDistExtra[dc];
+  }
+  lit_freq[256] = 1;
+
+  // dynamic codes and their run length encoded lengths
+  uint8_t lengths[286 + 30];
+  uint8_t* lit_len = lengths;
+  uint8_t* dist_len = lengths + 286;
+  huffman_lengths( lit_freq, 286, 15, lit_len );
+  huffman_lengths( dist_freq, 30, 15, dist_len );
+  int hlit = 286, hdist = 30;
+  while ( hlit > 257 && !lit_len[hlit - 1] ) --hlit;
+  while ( hdist > 1 && !dist_len[hdist - 1] ) --hdist;
+
+  uint8_t seq[286 + 30];
+  memcpy( seq, lit_len, hlit );
+  memcpy( seq + hlit, dist_len, hdist );
+  int n = hlit + hdist;
+  vector<pair<uint8_t, uint8_t> > runs;   // symbol, extra bits value
+  for ( int i = 0; i < n; ) {
+    int len = seq[i], run = 1;
+    while ( i + run < n && seq[i + run] == len ) ++run;
+    i += run;
+    if ( !len ) {
+      for ( ; run >= 11; run -= min( run, 138 ) ) {
+        runs.push_back( make_pair( 18, min( run, 138 ) - 11 ) );
+      }
+      if ( run >= 3 ) { runs.push_back( make_pair( 17, run - 3 ) ); run = 0; }
+    } else {
+      runs.push_back( make_pair( len, 0 ) ); run--;
+      for ( ; run >= 3; run -= min( run, 6 ) ) {
+        runs.push_back( make_pair( 16, min( run, 6 ) - 3 ) );
+      }
+    }
+    for ( ; run; --run ) runs.push_back( make_pair( len, 0 ) );
+  }
+
+  uint32_t cl_freq[19] = { 0 };
+  for ( size_t i = 0; i < runs.size(); ++i ) cl_freq[runs[i].first]++;
+  uint8_t cl_len[19];
+  huffman_lengths( cl_freq, 19, 7, cl_len );
+  int hclen = 19;
+  while ( hclen > 4 && !cl_len[kCodeLengthOrder[hclen - 1]] ) --hclen;
+
+  // sizes (in bits) of the three kinds of block
+  uint64_t dynamic_bits = 3 + 14 + 3 * hclen + extra_bits;
+  uint64_t fixed_bits = 3 + extra_bits;
+  for ( int i = 0; i < 19; ++i ) dynamic_bits += cl_freq[i] * cl_len[i];
+  dynamic_bits += cl_freq[16] * 2 + cl_freq[17] * 3 + cl_freq[18] * 7;
+  for ( int i = 0; i < 286; ++i ) {
+    dynamic_bits += lit_freq[i] * lit_len[i];
+    fixed_bits += lit_freq[i] * (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+  }
+  for ( int i = 0; i < 30; ++i ) {
+    dynamic_bits += dist_freq[i] * dist_len[i];
+    fixed_bits += dist_freq[i] * 5;
+  }
+  uint64_t stored_bits = 8 * size + 42 * (size / 65535 + 1);
+
+  if ( stored_bits <= fixed_bits && stored_bits <= dynamic_bits ) {
+    write_stored( w, data, size, final );
+    return;
+  }
+
+  uint16_t lit_code[288], dist_code[30];
+  if ( fixed_bits <= dynamic_bits ) {
+    uint8_t fixed[288 + 30];
+    for ( int i = 0; i < 288; ++i ) {
+      fixed[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    for ( int i = 0; i < 30; ++i ) fixed[288 + i] = 5;
+    memcpy( lengths, fixed, 286 );
+    memcpy( lengths + 286, fixed + 288, 30 );
+    huffman_codes( fixed, 288, lit_code );
+    huffman_codes( fixed + 288, 30, dist_code );
+    w.put( final ? 1 : 0, 1 );
+    w.put( 1, 2 );
+  } else {
+    uint16_t cl_code[19];
+    huffman_codes( lit_len, 286, lit_code );
+    huffman_codes( dist_len, 30, dist_code );
+    huffman_codes( cl_len, 19, cl_code );
+    w.put( final ? 1 : 0, 1 );
+    w.put( 2, 2 );
+    w.put( hlit - 257, 5 );
+    w.put( hdist - 1, 5 );
+    w.put( hclen - 4, 4 );
+    for ( int i = 0; i < hclen; ++i ) w.put( cl_len[kCodeLengthOrder[i]], 3 );
+    for ( size_t i = 0; i < runs.size(); ++i ) {
+      int s = runs[i].first;
+      w.put( cl_code[s], cl_len[s] );
+      if ( s == 16 ) w.put( runs[i].second, 2 );
+      if ( s == 17 ) w.put( runs[i].second, 3 );
+      if ( s == 18 ) w.put( runs[i].second, 7 );
+    }
+  }
+
+  for ( size_t i = 0; i < symbols.size(); ++i ) {
+    const Symbol& s = symbols[i];
+    if ( !s.length ) {
+      w.put( lit_code[s.value], lit_len[s.value] );
+      continue;
+    }
+    int lc = t.length_code[s.length], dc = t.distance( s.value );
+    w.put( lit_code[257 + lc], lit_len[257 + lc] );
+    w.put( s.length - kLengthBase[lc], kLengthExtra[lc] );
+    w.put( dist_code[dc], dist_len[dc] );
+    w.put( s.value - kDistBase[dc], kDistExtra[dc] );
+  }
+  w.put( lit_code[256], lit_len[256] );
+}
+
+// LZ77 match finder over hash chains of 3 byte prefixes
+struct Matcher {
+
+  const unsigned char* data;
+  int size;
+  int max_chain, nice;
+  vector<int> head, prev;
+
+  Matcher( const unsigned char* data, int size, int max_chain, int nice )
+    : data (data), size (size), max_chain (max_chain), nice (nice),
+      head (1 << kHashBits, -1), prev (kWindowSize) { }
+
+  inline uint32_t hash( int pos ) const {
+    uint32_t v = data[pos] << 16 | data[pos + 1] << 8 | data[pos + 2];
+    return (v * 2654435761u) >> (32 - kHashBits);
+  }
+
+  inline void insert( int pos ) {
+    if ( size - pos < kMinMatch ) return;
+    uint32_t h = hash( pos );
+    prev[pos & (kWindowSize - 1)] = head[h];
+    head[h] = pos;
+  }
+
+  // longest match at pos (0 if none), searched before inserting pos
+  int find( int pos, int& dist ) const {
+
+    int max_len = min( kMaxMatch, size - pos );
+    if ( max_len < kMinMatch ) return 0;
+
+    const unsigned char* b = data + pos;
+    int best = kMinMatch - 1;
+    int cand = head[hash( pos )];
+    for ( int chain = max_chain; cand >= 0 && chain; --chain ) {
+      if ( pos - cand > kWindowSize ) break;
+      const unsigned char* a = data + cand;
+      if ( a[best] == b[best] && a[0] == b[0] && a[1] == b[1] ) {
+        int len = 2;
+        while ( len < max_len && a[len] == b[len] ) ++len;
+        if ( len > best ) {
+          best = len;
+          dist = pos - cand;
+          if ( len >= nice || len == max_len ) break;
+        }
+      }
+      cand = prev[cand & (kWindowSize - 1)];
+    }
+
+    if ( best < kMinMatch || (best == kMinMatch && dist > kTooFar) ) return 0;
+    return best;
+  }
+};
+
+// Deflate size bytes of data to out as blocks of their own, the last one
+// final if final is set. Otherwise they are followed by an empty stored
+// block, so they end on a byte boundary and the stream can go on with
+// the deflate blocks of other data.
+static void deflate( const unsigned char* data, size_t size,
+                     PNGCompression compression, bool final,
+                     vector<unsigned char>& out ) {
+
+  BitWriter w( out );
+  if ( compression == PNG_STORE ) {
+    write_stored( w, data, size, final );
+    return;
+  }
+
+  // fast finds matches greedily along short chains, best looks one byte
+  // ahead for a longer match (lazy matching) along long chains
+  bool lazy = compression == PNG_BEST;
+  Matcher matcher( data, size, lazy ? 256 : 8, lazy ? kMaxMatch : 32 );
+  vector<Symbol> symbols;
+  symbols.reserve( kBlockSymbols );
+  size_t block_start = 0, emitted = 0;
+
+  int pos = 0, pending_len = 0, pending_dist = 0;
+  bool pending = false;
+  while ( pos < (int) size ) {
+
+    if ( symbols.size() >= kBlockSymbols ) {
+      write_block( w, symbols, data + block_start, emitted - block_start,
+                   false );
+      symbols.clear();
+      block_start = emitted;
+    }
+
+    int dist = 0;
+    int len = matcher.find( pos, dist );
+    matcher.insert( pos );
+
+    if ( !lazy ) {
+      Symbol s = { 0, data[pos] };
+      if ( len ) {
+        s.length = len; s.value = dist;
+        for ( int i = 1; i < len; ++i ) matcher.insert( pos + i );
+      }
+      symbols.push_back( s );
+      pos += len ? len : 1;
+      emitted = pos;
+      continue;
+    }
+
+    // the match at pos - 1 unless the one at pos is longer
+    if ( pending && pending_len >= len && pending_len >= kMinMatch ) {
+      Symbol s = { (uint16_t) pending_len, (uint16_t) pending_dist };
+      symbols.push_back( s );
+      int end = pos - 1 + pending_len;
+      for ( int i = pos + 1; i < end; ++i ) matcher.insert( i );
+      pos = end;
+      emitted = pos;
+      pending = false;
+      continue;
+    }
+    if ( pending ) {
+      Symbol s = { 0, data[pos - 1] };
+      symbols.push_back( s );
+      emitted = pos;
+    }
+    pending = true;
+    pending_len = len;
+    pending_dist = dist;
+    ++pos;
+  }
+
+  if ( pending ) {
+    Symbol s = { 0, data[pos - 1] };
+    if ( pending_len >= kMinMatch ) {
+      s.length = pending_len; s.value = pending_dist;
+    }
+    symbols.push_back( s );
+    emitted = size;
+  }
+
+  write_block( w, symbols, data + block_start, emitted - block_start, final );
+  if ( final ) w.align();
+  else write_stored( w, NULL, 0, false );
+}
+
+// Filters //
+
+static inline unsigned char paeth( int a, int b, int c ) {
+  int p = a + b - c;
+  int pa = abs( p - a ), pb = abs( p - b ), pc = abs( p - c );
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Filter row (n bytes, bpp per pixel) against the row above it (zeros
+// for the first row) into out: the filter type and the n residuals.
+// Every filter is tried and the one with the smallest sum of absolute
+// residuals (as signed bytes) is kept, unless only_none is set.
+static void filter_row( const unsigned char* row, const unsigned char* up,
+                        size_t n, int bpp, unsigned char* out,
+                        unsigned char* scratch, bool only_none ) {
+
+  out[0] = 0;
+  memcpy( out + 1, row, n );
+  if ( only_none ) return;
+
+  uint64_t best = 0;
+  for ( size_t i = 0; i < n; ++i ) best += abs( (signed char) row[i] );
+
+  for ( int type = 1; type < 5; ++type ) {
+    uint64_t sum = 0;
+    for ( size_t i = 0; i < n; ++i ) {
+      int a = i >= (size_t) bpp ? row[i - bpp] : 0;
+      int b = up[i];
+      int c = i >= (size_t) bpp ? up[i - bpp] : 0;
+      unsigned char predict = type == 1 ? a : type == 2 ? b :
+                              type == 3 ? (a + b) >> 1 : paeth( a, b, c );
+      scratch[i] = row[i] - predict;
+      sum += abs( (signed char) scratch[i] );
+    }
+    if ( sum < best ) {
+      best = sum;
+      out[0] = type;
+      memcpy( out + 1, scratch, n );
+    }
+  }
+}
+
+// Implements PNGEncoder //
+
+PNGEncoder::PNGEncoder( FILE* file, size_t width, size_t height,
+                        bool alpha, PNGCompression compression )
+  : file (file), buffer (NULL), width (width), height (height),
+    channels (alpha ? 4 : 3), compression (compression) {
+  begin();
+}
+
+PNGEncoder::PNGEncoder( vector<unsigned char>& buffer,
+                        size_t width, size_t height,
+                        bool alpha, PNGCompression compression )
+  : file (NULL), buffer (&buffer), width (width), height (height),
+    channels (alpha ? 4 : 3), compression (compression) {
+  begin();
+}
+
+void PNGEncoder::begin() {
+
+  rows_added = 0;
+  adler = 1;
+  failed = false;
+  band_rows = max( kBandBytes / (channels * width + 1), (size_t) 1 );
+  bands_per_flush = max( thread::hardware_concurrency(), 1u );
+
+  static const unsigned char signature[8] = {
+    137, 80, 78, 71, 13, 10, 26, 10 };
+  write( signature, 8 );
+
+  // 8 bits per channel, RGB or RGBA, not interlaced
+  unsigned char header[13] = {
+    (unsigned char) (width >> 24), (unsigned char) (width >> 16),
+    (unsigned char) (width >> 8),  (unsigned char) width,
+    (unsigned char) (height >> 24), (unsigned char) (height >> 16),
+    (unsigned char) (height >> 8),  (unsigned char) height,
+    8, (unsigned char) (channels == 4 ? 6 : 2), 0, 0, 0 };
+  write_chunk( "IHDR", header, 13 );
+}
+
+bool PNGEncoder::add_rows( const unsigned char* rows, size_t count ) {
+
+  size_t row_bytes = channels * width;
+  count = min( count, height - rows_added );
+  for ( size_t r = 0; r < count; ++r ) {
+
+    // start a band with the row above it
+    if ( pending.empty() || pending.back().rows == band_rows ) {
+      if ( pending.size() == bands_per_flush ) flush();
+      const unsigned char* above = pending.empty() ?
+        (last_row.empty() ? NULL : &last_row[0]) :
+        &pending.back().pixels[pending.back().pixels.size() - row_bytes];
+      pending.push_back( Band() );
+      Band& band = pending.back();
+      band.rows = 0;
+      band.first = rows_added == 0;
+      band.last = false;
+      band.pixels.reserve( (band_rows + 1) * row_bytes );
+      if ( above ) band.pixels.assign( above, above + row_bytes );
+    }
+
+    Band& band = pending.back();
+    const unsigned char* src = rows + 4 * width * r;
+    if ( channels == 4 ) {
+      band.pixels.insert( band.pixels.end(), src, src + row_bytes );
+    } else {
+      size_t end = band.pixels.size();
+      band.pixels.resize( end + row_bytes );
+      unsigned char* dst = &band.pixels[end];
+      for ( size_t x = 0; x < width; ++x ) {
+        dst[3 * x + 0] = src[4 * x + 0];
+        dst[3 * x + 1] = src[4 * x + 1];
+        dst[3 * x + 2] = src[4 * x + 2];
+      }
+    }
+    band.rows++;
+    rows_added++;
+  }
+
+  if ( count && rows_added == height ) {
+    pending.back().last = true;
+    flush();
+  }
+  return !failed;
+}
+
+void PNGEncoder::flush() {
+
+  // bands are filtered and deflated independently
+  #pragma omp parallel for schedule(dynamic)
+  for ( int i = 0; i < (int) pending.size(); ++i ) {
+    compress( pending[i] );
+  }
+
+  size_t row_bytes = channels * width;
+  last_row.assign( pending.back().pixels.end() - row_bytes,
+                   pending.back().pixels.end() );
+
+  for ( size_t i = 0; i < pending.size(); ++i ) {
+    Band& band = pending[i];
+    adler = adler32_combine( adler, band.adler, band.rows * (row_bytes + 1) );
+    if ( band.last ) {
+      unsigned char check[4] = {
+        (unsigned char) (adler >> 24), (unsigned char) (adler >> 16),
+        (unsigned char) (adler >> 8),  (unsigned char) adler };
+      band.data.insert( band.data.end(), check, check + 4 );
+    }
+    write_chunk( "IDAT", band.data.data(), band.data.size() );
+    if ( band.last ) write_chunk( "IEND", NULL, 0 );
+  }
+  pending.clear();
+}
+
+void PNGEncoder::compress( Band& band ) const {
+
+  size_t row_bytes = channels * width;
+  vector<unsigned char> filtered( band.rows * (row_bytes + 1) );
+  vector<unsigned char> scratch( row_bytes );
+  vector<unsigned char> zeros;
+
+  const unsigned char* up;
+  const unsigned char* row = &band.pixels[0];
+  if ( band.first ) {
+    zeros.assign( row_bytes, 0 );
+    up = &zeros[0];
+  } else {
+    up = row;
+    row += row_bytes;
+  }
+  for ( size_t r = 0; r < band.rows; ++r ) {
+    filter_row( row, up, row_bytes, channels,
+                &filtered[r * (row_bytes + 1)], &scratch[0],
+                compression == PNG_STORE );
+    up = row;
+    row += row_bytes;
+  }
+
+  // the first band starts the zlib stream (deflate, 32K window)
+  if ( band.first ) {
+    band.data.push_back( 0x78 );
+    band.data.push_back( compression == PNG_BEST ? 0xda :
+                         compression == PNG_FAST ? 0x5e : 0x01 );
+  }
+  band.adler = adler32( &filtered[0], filtered.size() );
+  deflate( &filtered[0], filtered.size(), compression, band.last,
+           band.data );
+}
+
+void PNGEncoder::write_chunk( const char* type, const unsigned char* data,
+                              size_t size ) {
+
+  unsigned char header[8] = {
+    (unsigned char) (size >> 24), (unsigned char) (size >> 16),
+    (unsigned char) (size >> 8),  (unsigned char) size,
+    (unsigned char) type[0], (unsigned char) type[1],
+    (unsigned char) type[2], (unsigned char) type[3] };
+  uint32_t crc = crc32( 0, header + 4, 4 );
+  if ( size ) crc = crc32( crc, data, size );
+  unsigned char check[4] = {
+    (unsigned char) (crc >> 24), (unsigned char) (crc >> 16),
+    (unsigned char) (crc >> 8),  (unsigned char) crc };
+
+  write( header, 8 );
+  if ( size ) write( data, size );
+  write( check, 4 );
+}
+
+void PNGEncoder::write( const unsigned char* data, size_t size ) {
+
+  if ( failed ) return;
+  if ( file ) {
+    failed = fwrite( data, 1, size, file ) != size;
+  } else {
+    buffer->insert( buffer->end(), data, data + size );
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,86 @@
+#ifndef CMU462_PNG_ENCODER_H
+#define CMU462_PNG_ENCODER_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <vector>
+
+#include "png.h"
+
+namespace CMU462 {
+
+/**
+ * Streaming PNG encoder. Rows of RGBA8 pixels are added in order, as they
+ * become available, and written out (to a file or appended to a buffer)
+ * in bands: every row is filtered with the filter that makes it smallest
+ * (by the sum of the absolute residuals), and each band is deflated on
+ * its own, so the bands pending are compressed on all cores and their
+ * streams joined as consecutive deflate blocks of the image's zlib
+ * stream. Memory is bounded by the bands in flight, whatever the size of
+ * the image. The image is written without alpha if it is opaque.
+ */
+class PNGEncoder {
+ public:
+
+  // encode a width x height image to file, or to the end of buffer
+  PNGEncoder( FILE* file, size_t width, size_t height, bool alpha,
+              PNGCompression compression = PNG_FAST );
+  PNGEncoder( std::vector<unsigned char>& buffer,
+              size_t width, size_t height, bool alpha,
+              PNGCompression compression = PNG_FAST );
+
+  // Add the next count rows (4 * width bytes each, RGBA). The image is
+  // written out completely once the last row was added. Returns false if
+  // writing failed (or had before).
+  bool add_rows( const unsigned char* rows, size_t count );
+
+  // false if writing failed
+  inline bool good() const {
+    return !failed;
+  }
+
+ private:
+
+  // A band of rows, deflated on its own. pixels (raw, of the output
+  // format) starts with the row before the band, if it is not the first.
+  struct Band {
+    size_t rows;
+    bool first, last;
+    std::vector<unsigned char> pixels;
+    std::vector<unsigned char> data;
+    uint32_t adler;
+  };
+
+  void begin();
+
+  // filter and deflate the pending bands on all threads and write them
+  void flush();
+  void compress( Band& band ) const;
+
+  // write a chunk, with its length and CRC
+  void write_chunk( const char* type, const unsigned char* data,
+                    size_t size );
+  void write( const unsigned char* data, size_t size );
+
+  FILE* file;
+  std::vector<unsigned char>* buffer;
+
+  size_t width, height;
+  size_t channels;
+  PNGCompression compression;
+
+  // rows per band, bands compressed at once
+  size_t band_rows;
+  size_t bands_per_flush;
+
+  std::vector<Band> pending;
+  std::vector<unsigned char> last_row;
+  size_t rows_added;
+  uint32_t adler;
+  bool failed;
+
+}; // class PNGEncoder
+
+} // namespace CMU462
+
+#endif // CMU462_PNG_ENCODER_H
@@ -0,0 +1,445 @@
+#include "raster_kernels.h"
+
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DRAWSVG_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// functions using instructions beyond the build target
+#if defined(DRAWSVG_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+SampleColor quantize( const Color& c, SampleFormat format ) {
+
+  float max = format == SAMPLE_RGBA16 ? 65535.0f : 255.0f;
+  float a = std::max(0.0f, std::min(1.0f, c.a));
+  SampleColor q;
+  q.rgba[0] = (uint16_t) (std::max(0.0f, std::min(1.0f, c.r)) * a * max + 0.5f);
+  q.rgba[1] = (uint16_t) (std::max(0.0f, std::min(1.0f, c.g)) * a * max + 0.5f);
+  q.rgba[2] = (uint16_t) (std::max(0.0f, std::min(1.0f, c.b)) * a * max + 0.5f);
+  q.rgba[3] = (uint16_t) (a * max + 0.5f);
+  q.inv_alpha = (uint16_t) max - q.rgba[3];
+  return q;
+}
+
+// Scalar //
+
+static unsigned coverage_scalar( const double* cx, const double* ry, int n ) {
+  unsigned mask = 0;
+  for (int k = 0; k < n; k++) {
+    if (cx[k] >= ry[0] && cx[8 + k] >= ry[1] && cx[16 + k] >= ry[2]) {
+      mask |= 1u << k;
+    }
+  }
+  return mask;
+}
+
+template <void (*blend)( unsigned char*, const SampleColor& ), int size>
+static void blend_mask_scalar( unsigned char* samples, unsigned mask,
+                               const SampleColor& c ) {
+  if (c.transparent()) return;
+  for (int k = 0; mask; k++, mask >>= 1) {
+    if (mask & 1) blend(samples + size * k, c);
+  }
+}
+
+template <void (*blend)( unsigned char*, const SampleColor& ), int size>
+static void blend_span_scalar( unsigned char* samples, int n,
+                               const SampleColor& c ) {
+  if (c.transparent()) return;
+  for (int k = 0; k < n; k++) {
+    blend(samples + size * k, c);
+  }
+}
+
+// the opaque span fill shared by all instruction sets
+static bool fill_opaque( unsigned char* samples, int n, const SampleColor& c,
+                         SampleFormat format ) {
+  if (!c.opaque()) return false;
+  if (format == SAMPLE_RGBA16) {
+    uint16_t* s = (uint16_t*) samples;
+    for (int k = 0; k < n; k++, s += 4) memcpy(s, c.rgba, 8);
+  } else {
+    uint32_t packed = c.rgba[0] | c.rgba[1] << 8 | c.rgba[2] << 16 |
+                      (uint32_t) c.rgba[3] << 24;
+    uint32_t* s = (uint32_t*) samples;
+    for (int k = 0; k < n; k++) s[k] = packed;
+  }
+  return true;
+}
+
+static void blend_span8_scalar( unsigned char* samples, int n,
+                                const SampleColor& c ) {
+  if (fill_opaque(samples, n, c, SAMPLE_RGBA8)) return;
+  blend_span_scalar<blend_sample8, 4>(samples, n, c);
+}
+
+static void blend_span16_scalar( unsigned char* samples, int n,
+                                 const SampleColor& c ) {
+  if (fill_opaque(samples, n, c, SAMPLE_RGBA16)) return;
+  blend_span_scalar<blend_sample16, 8>(samples, n, c);
+}
+
+// map n interleaved x, y pairs by the affine m = { a, b, c, d, e, f }
+static void transform_points_scalar( const double* m, const double* in,
+                                     double* out, size_t n ) {
+  for (size_t i = 0; i < 2 * n; i += 2) {
+    double x = in[i], y = in[i + 1];
+    out[i]     = m[0] * x + m[2] * y + m[4];
+    out[i + 1] = m[1] * x + m[3] * y + m[5];
+  }
+}
+
+// index past the highest set bit of a coverage mask
+static inline int mask_end( unsigned mask ) {
+  int n = 0;
+  while (mask >> n) n++;
+  return n;
+}
+
+#ifdef DRAWSVG_X86
+
+// SSE2 //
+
+static unsigned coverage_sse2( const double* cx, const double* ry, int n ) {
+  __m128d r0 = _mm_set1_pd(ry[0]);
+  __m128d r1 = _mm_set1_pd(ry[1]);
+  __m128d r2 = _mm_set1_pd(ry[2]);
+  unsigned mask = 0;
+  for (int k = 0; k < 8; k += 2) {
+    __m128d in = _mm_and_pd(
+        _mm_and_pd(_mm_cmpge_pd(_mm_loadu_pd(cx +      k), r0),
+                   _mm_cmpge_pd(_mm_loadu_pd(cx +  8 + k), r1)),
+                   _mm_cmpge_pd(_mm_loadu_pd(cx + 16 + k), r2));
+    mask |= _mm_movemask_pd(in) << k;
+  }
+  return mask & ((1u << n) - 1);
+}
+
+// blend 4 RGBA8 samples, same arithmetic as blend_sample8
+static inline __m128i blend4x8_sse2( __m128i dst, __m128i inv, __m128i src ) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi16(128);
+  __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), inv), half);
+  __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), inv), half);
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+  return _mm_add_epi8(_mm_packus_epi16(lo, hi), src);
+}
+
+// blend 2 RGBA16 samples, same arithmetic as blend_sample16
+static inline __m128i blend2x16_sse2( __m128i dst, __m128i inv, __m128i src ) {
+  const __m128i half = _mm_set1_epi32(32768);
+  const __m128i bias = _mm_set1_epi16((short) 0x8000);
+  __m128i pl = _mm_mullo_epi16(dst, inv);
+  __m128i ph = _mm_mulhi_epu16(dst, inv);
+  __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(pl, ph), half);
+  __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(pl, ph), half);
+  lo = _mm_srli_epi32(_mm_add_epi32(lo, _mm_srli_epi32(lo, 16)), 16);
+  hi = _mm_srli_epi32(_mm_add_epi32(hi, _mm_srli_epi32(hi, 16)), 16);
+
+  // SSE2 only packs signed, so pack around the 0x8000 bias
+  lo = _mm_sub_epi32(lo, half);
+  hi = _mm_sub_epi32(hi, half);
+  __m128i blended = _mm_xor_si128(_mm_packs_epi32(lo, hi), bias);
+  return _mm_add_epi16(blended, src);
+}
+
+static inline __m128i src8_sse2( const SampleColor& c ) {
+  return _mm_set1_epi32(c.rgba[0] | c.rgba[1] << 8 | c.rgba[2] << 16 |
+                        (uint32_t) c.rgba[3] << 24);
+}
+
+static inline __m128i src16_sse2( const SampleColor& c ) {
+  return _mm_setr_epi16(c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3],
+                        c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3]);
+}
+
+static void blend_mask8_sse2( unsigned char* samples, unsigned mask,
+                              const SampleColor& c ) {
+  if (c.transparent()) return;
+  __m128i inv = _mm_set1_epi16(c.inv_alpha);
+  __m128i src = src8_sse2(c);
+  const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+
+  // vector groups never read past the last covered sample
+  int end = mask_end(mask), k = 0;
+  for (; k + 4 <= end; k += 4, mask >>= 4) {
+    if (!(mask & 15)) continue;
+    __m128i* p = (__m128i*) (samples + 4 * k);
+    __m128i dst = _mm_loadu_si128(p);
+    __m128i sel = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), bits), bits);
+    __m128i out = blend4x8_sse2(dst, inv, src);
+    _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(sel, out),
+                                     _mm_andnot_si128(sel, dst)));
+  }
+  blend_mask_scalar<blend_sample8, 4>(samples + 4 * k, mask, c);
+}
+
+static void blend_span8_sse2( unsigned char* samples, int n,
+                              const SampleColor& c ) {
+  if (c.transparent() || fill_opaque(samples, n, c, SAMPLE_RGBA8)) return;
+  __m128i inv = _mm_set1_epi16(c.inv_alpha);
+  __m128i src = src8_sse2(c);
+  int k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128i* p = (__m128i*) (samples + 4 * k);
+    _mm_storeu_si128(p, blend4x8_sse2(_mm_loadu_si128(p), inv, src));
+  }
+  blend_span_scalar<blend_sample8, 4>(samples + 4 * k, n - k, c);
+}
+
+static void blend_mask16_sse2( unsigned char* samples, unsigned mask,
+                               const SampleColor& c ) {
+  if (c.transparent()) return;
+  __m128i inv = _mm_set1_epi16(c.inv_alpha);
+  __m128i src = src16_sse2(c);
+
+  int end = mask_end(mask), k = 0;
+  for (; k + 2 <= end; k += 2, mask >>= 2) {
+    if (!(mask & 3)) continue;
+    __m128i* p = (__m128i*) (samples + 8 * k);
+    __m128i dst = _mm_loadu_si128(p);
+    __m128i sel = _mm_set_epi32((mask & 2) ? -1 : 0, (mask & 2) ? -1 : 0,
+                                (mask & 1) ? -1 : 0, (mask & 1) ? -1 : 0);
+    __m128i out = blend2x16_sse2(dst, inv, src);
+    _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(sel, out),
+                                     _mm_andnot_si128(sel, dst)));
+  }
+  blend_mask_scalar<blend_sample16, 8>(samples + 8 * k, mask, c);
+}
+
+static void blend_span16_sse2( unsigned char* samples, int n,
+                               const SampleColor& c ) {
+  if (c.transparent() || fill_opaque(samples, n, c, SAMPLE_RGBA16)) return;
+  __m128i inv = _mm_set1_epi16(c.inv_alpha);
+  __m128i src = src16_sse2(c);
+  int k = 0;
+  for (; k + 2 <= n; k += 2) {
+    __m128i* p = (__m128i*) (samples + 8 * k);
+    _mm_storeu_si128(p, blend2x16_sse2(_mm_loadu_si128(p), inv, src));
+  }
+  blend_span_scalar<blend_sample16, 8>(samples + 8 * k, n - k, c);
+}
+
+// one point per register: (x, x) * (a, b) + (y, y) * (c, d) + (e, f)
+static void transform_points_sse2( const double* m, const double* in,
+                                   double* out, size_t n ) {
+  __m128d ab = _mm_loadu_pd(m);
+  __m128d cd = _mm_loadu_pd(m + 2);
+  __m128d ef = _mm_loadu_pd(m + 4);
+  for (size_t i = 0; i < 2 * n; i += 2) {
+    __m128d p = _mm_loadu_pd(in + i);
+    __m128d x = _mm_unpacklo_pd(p, p);
+    __m128d y = _mm_unpackhi_pd(p, p);
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(ab, x),
+                                                 _mm_mul_pd(cd, y)), ef));
+  }
+}
+
+// AVX2 //
+
+TARGET_AVX2
+static unsigned coverage_avx2( const double* cx, const double* ry, int n ) {
+  __m256d r0 = _mm256_set1_pd(ry[0]);
+  __m256d r1 = _mm256_set1_pd(ry[1]);
+  __m256d r2 = _mm256_set1_pd(ry[2]);
+  unsigned mask = 0;
+  for (int k = 0; k < 8; k += 4) {
+    __m256d in = _mm256_and_pd(
+        _mm256_and_pd(
+          _mm256_cmp_pd(_mm256_loadu_pd(cx +      k), r0, _CMP_GE_OQ),
+          _mm256_cmp_pd(_mm256_loadu_pd(cx +  8 + k), r1, _CMP_GE_OQ)),
+          _mm256_cmp_pd(_mm256_loadu_pd(cx + 16 + k), r2, _CMP_GE_OQ));
+    mask |= _mm256_movemask_pd(in) << k;
+  }
+  return mask & ((1u << n) - 1);
+}
+
+// blend 8 RGBA8 samples, same arithmetic as blend_sample8
+TARGET_AVX2
+static inline __m256i blend8x8_avx2( __m256i dst, __m256i inv, __m256i src ) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i half = _mm256_set1_epi16(128);
+  __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), inv), half);
+  __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), inv), half);
+  lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+  hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+  return _mm256_add_epi8(_mm256_packus_epi16(lo, hi), src);
+}
+
+// blend 4 RGBA16 samples, same arithmetic as blend_sample16
+TARGET_AVX2
+static inline __m256i blend4x16_avx2( __m256i dst, __m256i inv, __m256i src ) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i half = _mm256_set1_epi32(32768);
+  __m256i lo = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_unpacklo_epi16(dst, zero), inv), half);
+  __m256i hi = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_unpackhi_epi16(dst, zero), inv), half);
+  lo = _mm256_srli_epi32(_mm256_add_epi32(lo, _mm256_srli_epi32(lo, 16)), 16);
+  hi = _mm256_srli_epi32(_mm256_add_epi32(hi, _mm256_srli_epi32(hi, 16)), 16);
+  return _mm256_add_epi16(_mm256_packus_epi32(lo, hi), src);
+}
+
+TARGET_AVX2
+static void blend_mask8_avx2( unsigned char* samples, unsigned mask,
+                              const SampleColor& c ) {
+  if (c.transparent()) return;
+  __m256i inv = _mm256_set1_epi16(c.inv_alpha);
+  __m256i src = _mm256_set1_epi32(c.rgba[0] | c.rgba[1] << 8 |
+                                  c.rgba[2] << 16 | (uint32_t) c.rgba[3] << 24);
+  if (mask_end(mask) < 8) {
+    blend_mask8_sse2(samples, mask, c);
+    return;
+  }
+  const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  __m256i* p = (__m256i*) samples;
+  __m256i dst = _mm256_loadu_si256(p);
+  __m256i sel = _mm256_cmpeq_epi32(
+      _mm256_and_si256(_mm256_set1_epi32(mask), bits), bits);
+  __m256i out = blend8x8_avx2(dst, inv, src);
+  _mm256_storeu_si256(p, _mm256_blendv_epi8(dst, out, sel));
+}
+
+TARGET_AVX2
+static void blend_span8_avx2( unsigned char* samples, int n,
+                              const SampleColor& c ) {
+  if (c.transparent() || fill_opaque(samples, n, c, SAMPLE_RGBA8)) return;
+  __m256i inv = _mm256_set1_epi16(c.inv_alpha);
+  __m256i src = _mm256_set1_epi32(c.rgba[0] | c.rgba[1] << 8 |
+                                  c.rgba[2] << 16 | (uint32_t) c.rgba[3] << 24);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256i* p = (__m256i*) (samples + 4 * k);
+    _mm256_storeu_si256(p, blend8x8_avx2(_mm256_loadu_si256(p), inv, src));
+  }
+  blend_span8_sse2(samples + 4 * k, n - k, c);
+}
+
+TARGET_AVX2
+static void blend_mask16_avx2( unsigned char* samples, unsigned mask,
+                               const SampleColor& c ) {
+  if (c.transparent()) return;
+  __m256i inv = _mm256_set1_epi32(c.inv_alpha);
+  __m256i src = _mm256_setr_epi16(c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3],
+                                  c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3],
+                                  c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3],
+                                  c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3]);
+  const __m256i bits = _mm256_setr_epi64x(1, 2, 4, 8);
+
+  int end = mask_end(mask), k = 0;
+  for (; k + 4 <= end; k += 4, mask >>= 4) {
+    if (!(mask & 15)) continue;
+    __m256i* p = (__m256i*) (samples + 8 * k);
+    __m256i dst = _mm256_loadu_si256(p);
+    __m256i sel = _mm256_cmpeq_epi64(
+        _mm256_and_si256(_mm256_set1_epi64x(mask), bits), bits);
+    __m256i out = blend4x16_avx2(dst, inv, src);
+    _mm256_storeu_si256(p, _mm256_blendv_epi8(dst, out, sel));
+  }
+  blend_mask16_sse2(samples + 8 * k, mask, c);
+}
+
+TARGET_AVX2
+static void blend_span16_avx2( unsigned char* samples, int n,
+                               const SampleColor& c ) {
+  if (c.transparent() || fill_opaque(samples, n, c, SAMPLE_RGBA16)) return;
+  __m256i inv = _mm256_set1_epi32(c.inv_alpha);
+  __m256i src = _mm256_setr_epi16(c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3],
+                                  c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3],
+                                  c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3],
+                                  c.rgba[0], c.rgba[1], c.rgba[2], c.rgba[3]);
+  int k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m256i* p = (__m256i*) (samples + 8 * k);
+    _mm256_storeu_si256(p, blend4x16_avx2(_mm256_loadu_si256(p), inv, src));
+  }
+  blend_span16_sse2(samples + 8 * k, n - k, c);
+}
+
+// two points per register, the rest as in transform_points_sse2
+TARGET_AVX2
+static void transform_points_avx2( const double* m, const double* in,
+                                   double* out, size_t n ) {
+  __m256d ab = _mm256_set_pd(m[1], m[0], m[1], m[0]);
+  __m256d cd = _mm256_set_pd(m[3], m[2], m[3], m[2]);
+  __m256d ef = _mm256_set_pd(m[5], m[4], m[5], m[4]);
+  size_t i = 0;
+  for (; i + 4 <= 2 * n; i += 4) {
+    __m256d p = _mm256_loadu_pd(in + i);
+    __m256d x = _mm256_unpacklo_pd(p, p);
+    __m256d y = _mm256_unpackhi_pd(p, p);
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ab, x),
+                                                          _mm256_mul_pd(cd, y)), ef));
+  }
+  transform_points_sse2(m, in + i, out + i, n - i / 2);
+}
+
+static bool cpu_has_avx2() {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx     = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return false;
+#endif
+}
+
+#endif // DRAWSVG_X86
+
+static RasterKernels select_kernels() {
+
+  RasterKernels scalar = { "scalar", coverage_scalar,
+    { blend_mask_scalar<blend_sample8, 4>,
+      blend_mask_scalar<blend_sample16, 8> },
+    { blend_span8_scalar, blend_span16_scalar },
+    transform_points_scalar };
+  const char* force = getenv("DRAWSVG_SIMD");
+  string requested = force ? force : "";
+  if (requested == "scalar") return scalar;
+
+#ifdef DRAWSVG_X86
+  RasterKernels sse2 = { "sse2", coverage_sse2,
+    { blend_mask8_sse2, blend_mask16_sse2 },
+    { blend_span8_sse2, blend_span16_sse2 },
+    transform_points_sse2 };
+  RasterKernels avx2 = { "avx2", coverage_avx2,
+    { blend_mask8_avx2, blend_mask16_avx2 },
+    { blend_span8_avx2, blend_span16_avx2 },
+    transform_points_avx2 };
+  if (requested == "sse2") return sse2;
+  return cpu_has_avx2() ? avx2 : sse2;
+#else
+  return scalar;
+#endif
+}
+
+const RasterKernels& raster_kernels() {
+  static const RasterKernels kernels = select_kernels();
+  return kernels;
+}
+
+} // namespace CMU462
@@ -0,0 +1,121 @@
+#ifndef CMU462_RASTER_KERNELS_H
+#define CMU462_RASTER_KERNELS_H
+
+#include <stdint.h>
+
+#include "CMU462.h"
+#include "color.h"
+
+namespace CMU462 {
+
+/**
+ * Storage formats of the sample buffer. Samples are premultiplied RGBA
+ * with 8 or 16 bits per channel; 16 bits keep deep stacks of translucent
+ * layers from banding.
+ */
+typedef enum SampleFormat {
+  SAMPLE_RGBA8  = 0,
+  SAMPLE_RGBA16 = 1
+} SampleFormat;
+
+static const int kNumSampleFormats = 2;
+
+// bytes per sample
+inline size_t sample_size( SampleFormat format ) {
+  return format == SAMPLE_RGBA16 ? 8 : 4;
+}
+
+/**
+ * A premultiplied color quantized to a sample format. Blending computes
+ * dst = rgba + dst * inv_alpha / max for each channel, where max is 255
+ * or 65535, rounding the product to nearest.
+ */
+struct SampleColor {
+  uint16_t rgba[4];
+  uint16_t inv_alpha;
+
+  // fully transparent colors leave the samples untouched
+  inline bool transparent() const { return rgba[3] == 0; }
+
+  // opaque colors replace the samples
+  inline bool opaque() const { return inv_alpha == 0; }
+};
+
+// quantize a (non premultiplied) color to the given format
+SampleColor quantize( const Color& c, SampleFormat format );
+
+/**
+ * Per-sample and per-vertex kernels of the software rasterizer. Each
+ * kernel has a scalar version and SSE2/AVX2 versions that produce
+ * bit-identical results. The best version supported by the host cpu is
+ * picked at runtime, it can be overridden by setting DRAWSVG_SIMD to
+ * "scalar", "sse2" or "avx2".
+ */
+struct RasterKernels {
+
+  // name of the selected instruction set
+  const char* name;
+
+  // Coverage of a row of n <= 8 samples against three edges. Bit k of the
+  // result is set when cx[8 * i + k] >= ry[i] holds for all edges i.
+  unsigned (*coverage)( const double* cx, const double* ry, int n );
+
+  // Blend c over the samples k < 8 whose bit is set in mask, indexed by
+  // sample format.
+  void (*blend_mask[kNumSampleFormats])( unsigned char* samples,
+                                         unsigned mask,
+                                         const SampleColor& c );
+
+  // Blend c over n consecutive samples, indexed by sample format.
+  void (*blend_span[kNumSampleFormats])( unsigned char* samples, int n,
+                                         const SampleColor& c );
+
+  // Map n points, stored as interleaved x, y pairs, by the affine
+  // transformation m = { a, b, c, d, e, f }: x' = a x + c y + e and
+  // y' = b x + d y + f, evaluated left to right.
+  void (*transform_points)( const double* m, const double* in,
+                            double* out, size_t n );
+
+};
+
+// kernels selected for this cpu
+const RasterKernels& raster_kernels();
+
+// blend c over one RGBA8 sample
+inline void blend_sample8( unsigned char* sample, const SampleColor& c ) {
+  for (int i = 0; i < 4; i++) {
+    unsigned v = sample[i] * c.inv_alpha + 128;
+    sample[i] = (uint8_t)(c.rgba[i] + ((v + (v >> 8)) >> 8));
+  }
+}
+
+// blend c over one RGBA16 sample
+inline void blend_sample16( unsigned char* sample, const SampleColor& c ) {
+  uint16_t* s = (uint16_t*) sample;
+  for (int i = 0; i < 4; i++) {
+    uint32_t v = (uint32_t) s[i] * c.inv_alpha + 32768;
+    s[i] = (uint16_t)(c.rgba[i] + ((v + (v >> 16)) >> 16));
+  }
+}
+
+// blend c over one sample of the given format
+inline void blend_sample( unsigned char* sample, const SampleColor& c,
+                          SampleFormat format ) {
+  if (format == SAMPLE_RGBA16) {
+    blend_sample16(sample, c);
+  } else {
+    blend_sample8(sample, c);
+  }
+}
+
+// Resolve one channel from the sum of n samples to 8 bits, rounding the
+// average to nearest
+inline unsigned char resolve_channel( uint32_t sum, uint32_t n,
+                                      SampleFormat format ) {
+  uint32_t avg = (sum + n / 2) / n;
+  return format == SAMPLE_RGBA16 ? (avg * 255 + 32767) / 65535 : avg;
+}
+
+} // namespace CMU462
+
+#endif // CMU462_RASTER_KERNELS_H
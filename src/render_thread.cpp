@@ -0,0 +1,154 @@
+#include "render_thread.h"
+
+#include <cmath>
+
+using namespace std;
+
+namespace CMU462 {
+
+RenderThread::RenderThread( )
+  : mailbox (NULL), stale (false), back (0), front (2), published (1),
+    canvas_valid (false), canvas_rate (0), busy (false), stopping (false) {
+
+  for ( int i = 0; i < 3; ++i ) frames[i].seq = 0;
+  renderer.set_cancel( &stale );
+  thread = std::thread( &RenderThread::run, this );
+}
+
+RenderThread::~RenderThread( ) {
+
+  stale = true;
+  {
+    lock_guard<std::mutex> lock( mutex );
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+  delete mailbox.exchange( NULL );
+}
+
+void RenderThread::post( const FrameSpec& spec, size_t seq ) {
+
+  Request* request = new Request;
+  request->spec = spec;
+  request->seq = seq;
+
+  // Flag the frame being rendered before replacing the view. The thread
+  // clears the flag only after it took a view, so the new view is never
+  // cancelled by its own flag; at worst the flag is cleared before it
+  // reached the frame it was meant for, which is then finished.
+  stale = true;
+  delete mailbox.exchange( request );
+
+  // the thread checks the mailbox under the mutex before it sleeps
+  { lock_guard<std::mutex> lock( mutex ); }
+  wake.notify_one();
+}
+
+const RenderThread::Frame& RenderThread::latest() {
+
+  if ( published.load() & kFresh ) {
+    front = published.exchange( front ) & ~kFresh;
+  }
+  return frames[front];
+}
+
+void RenderThread::stop() {
+
+  stale = true;
+  delete mailbox.exchange( NULL );
+
+  unique_lock<std::mutex> lock( mutex );
+  done.wait( lock, [this] { return !busy; } );
+  canvas_valid = false;
+}
+
+void RenderThread::run() {
+
+  while ( true ) {
+
+    {
+      unique_lock<std::mutex> lock( mutex );
+      busy = false;
+      done.notify_all();
+      wake.wait( lock, [this] { return stopping || mailbox.load(); } );
+      if ( stopping ) return;
+      busy = true;
+    }
+
+    // take the view before clearing the flag, a post in between would
+    // otherwise flag the newest view and it would be dropped
+    Request* request = mailbox.exchange( NULL );
+    if ( !request ) continue;
+    stale = false;
+
+    if ( render( *request ) ) {
+      Frame& frame = frames[back];
+      frame.spec = request->spec;
+      frame.seq = request->seq;
+      frame.pixels.assign( canvas.begin(), canvas.end() );
+      back = published.exchange( back | kFresh ) & ~kFresh;
+    }
+    delete request;
+  }
+}
+
+bool RenderThread::render( const Request& request ) {
+
+  const FrameSpec& spec = request.spec;
+  renderer.set_tex_sampler( spec.sampler );
+  renderer.set_msaa( spec.msaa );
+  renderer.set_analytic( spec.analytic );
+  renderer.set_scanline( spec.scanline );
+  renderer.set_sample_format( spec.sample_format );
+
+  // the target is set before the sample rate, which clears it
+  if ( canvas.size() != 4 * spec.width * spec.height ) {
+    canvas.resize( 4 * spec.width * spec.height );
+    renderer.set_render_target( &canvas[0], spec.width, spec.height );
+    canvas_rate = 0;
+  }
+  if ( spec.sample_rate != canvas_rate ) {
+    renderer.set_sample_rate( spec.sample_rate );
+    canvas_rate = spec.sample_rate;
+    canvas_valid = false;
+  }
+  renderer.set_svg_2_screen( spec.svg_2_screen );
+
+  // Pan the canvas if only the translation changed, by whole pixels (up
+  // to rounding of the viewbox). Pans draw little and are not cancelled,
+  // or a steady drag would never show a frame.
+  bool pannable = false;
+  double dx = 0, dy = 0;
+  if ( canvas_valid ) {
+    FrameSpec moved = canvas_spec;
+    moved.svg_2_screen(0,2) = spec.svg_2_screen(0,2);
+    moved.svg_2_screen(1,2) = spec.svg_2_screen(1,2);
+    double tx = spec.svg_2_screen(0,2) - canvas_spec.svg_2_screen(0,2);
+    double ty = spec.svg_2_screen(1,2) - canvas_spec.svg_2_screen(1,2);
+    dx = floor( tx + 0.5 ); dy = floor( ty + 0.5 );
+    const double tolerance = 1.0 / 64;
+    pannable = moved == spec &&
+               fabs( tx - dx ) <= tolerance && fabs( ty - dy ) <= tolerance;
+  }
+
+  if ( pannable ) {
+    renderer.set_cancel( NULL );
+    renderer.pan_svg( *spec.svg, (int) dx, (int) dy );
+    renderer.set_cancel( &stale );
+  } else {
+    renderer.draw_svg( *spec.svg );
+
+    // a cancelled frame is incomplete, the next one is drawn in full
+    if ( stale ) {
+      canvas_valid = false;
+      return false;
+    }
+  }
+
+  canvas_valid = true;
+  canvas_spec = spec;
+  return true;
+}
+
+} // namespace CMU462
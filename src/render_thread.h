@@ -0,0 +1,104 @@
+#ifndef CMU462_RENDER_THREAD_H
+#define CMU462_RENDER_THREAD_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "CMU462.h"
+#include "software_renderer.h"
+#include "background_renderer.h"
+
+namespace CMU462 {
+
+/**
+ * Renders the frames of the view being shown on a thread of its own, so
+ * a slow frame does not hold up the event loop. The view to render is
+ * posted to a single-slot mailbox: posting replaces any view the thread
+ * did not take yet and cancels the frame being rendered, so the thread
+ * always works on the newest view. Finished frames are published through
+ * a triple buffer, both without locks. The thread draws into a canvas of
+ * its own that keeps the last frame, so a view that only moved by whole
+ * pixels is panned (only the exposed strips are drawn), as in the
+ * interactive renderer. Documents are only read: their display lists
+ * must be compiled, and neither they nor their mipmaps may change while
+ * posted (stop first).
+ */
+class RenderThread {
+ public:
+
+  // a finished frame, seq being the number it was posted with
+  struct Frame {
+    FrameSpec spec;
+    size_t seq;
+    std::vector<unsigned char> pixels;
+  };
+
+  RenderThread( );
+
+  // stops the thread
+  ~RenderThread( );
+
+  // Render spec next, replacing a view that was posted before and not
+  // started yet, and cancelling the one being rendered. seq numbers the
+  // frame and must grow from post to post.
+  void post( const FrameSpec& spec, size_t seq );
+
+  // The newest finished frame (seq 0 if there is none yet). It is not
+  // written to until the next call.
+  const Frame& latest();
+
+  // Drop the posted view, wait for the frame being rendered (cancelled)
+  // and forget the canvas, so the documents can change.
+  void stop();
+
+ private:
+
+  struct Request {
+    FrameSpec spec;
+    size_t seq;
+  };
+
+  // thread main loop
+  void run();
+
+  // draw a request into the canvas, false if it was cancelled
+  bool render( const Request& request );
+
+  SoftwareRendererImp renderer;
+
+  // newest view not taken by the thread yet, or NULL
+  std::atomic<Request*> mailbox;
+
+  // set when a view is posted, cancels the frame being rendered
+  std::atomic<bool> stale;
+
+  // Triple buffer: the thread fills frames[back] and swaps it with the
+  // published index (ORed with kFresh), the reader swaps frames[front]
+  // for a fresh published one.
+  static const int kFresh = 4;
+  Frame frames[3];
+  int back, front;
+  std::atomic<int> published;
+
+  // The canvas the renderer draws into, the frame it holds (if valid)
+  // and the sample rate the renderer was set to for it.
+  std::vector<unsigned char> canvas;
+  bool canvas_valid;
+  FrameSpec canvas_spec;
+  size_t canvas_rate;
+
+  // set while the thread took (or is taking) a request
+  bool busy;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::thread thread;
+
+}; // class RenderThread
+
+} // namespace CMU462
+
+#endif // CMU462_RENDER_THREAD_H
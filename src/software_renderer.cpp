@@ -1,33 +1,158 @@
 #include "software_renderer.h"
 
+#include <assert.h>
 #include <cmath>
+#include <cstdlib>
 #include <vector>
 #include <iostream>
 #include <algorithm>
 
-#include "triangulation.h"
+#include "raster_kernels.h"
 
 using namespace std;
 
 namespace CMU462 {
 
 
+// Block size (in samples) used to classify triangle coverage
+static const int kBlockSize = 8;
+
+// Fractional bits of the fixed point vertex coordinates
+static const int kSubpixelBits = 8;
+
+// Triangles are clipped to [-kGuardBand, kGuardBand] (in samples) so the
+// 64 bit edge functions cannot overflow
+static const float kGuardBand = 1 << 20;
+
+// Memory (in bytes) available to pixels the MSAA storage fully expands
+static const size_t kCoverageBudget = 64 << 20;
+
 // Implements SoftwareRenderer //
-unsigned char* super_sample_buffer;
-std::stack<Matrix3x3> transformation_stack;
-int ss_target_w;
-int ss_target_h;
 
 void SoftwareRendererImp::draw_svg( SVG& svg ) {
 
+  draw_region( svg, 0, 0, target_w, target_h );
+
+}
+
+void SoftwareRendererImp::pan_svg( SVG& svg, int dx, int dy ) {
+
+  int w = target_w, h = target_h;
+  if ( abs(dx) >= w || abs(dy) >= h ) {
+    draw_svg( svg );
+    return;
+  }
+
+  // Shift the previous frame along. Its samples were cleared when it was
+  // resolved, so only the pixels need to move. Rows are copied away from
+  // the direction of the shift so none is overwritten before it is read.
+  size_t row = 4 * (w - abs(dx));
+  int src_x = max(-dx, 0), dst_x = max(dx, 0);
+  for ( int i = 0; i < h - abs(dy); ++i ) {
+    int y = dy > 0 ? h - dy - 1 - i : i - dy;
+    memmove( &render_target[4 * (dst_x + (y + dy) * w)],
+             &render_target[4 * (src_x + y * w)], row );
+  }
+
+  // draw the exposed rows, then the exposed columns of the other rows
+  if ( dy ) {
+    draw_region( svg, 0, dy > 0 ? 0 : h + dy, w, dy > 0 ? dy : h );
+  }
+  if ( dx ) {
+    draw_region( svg, dx > 0 ? 0 : w + dx, max(dy, 0),
+                      dx > 0 ? dx : w,     min(h, h + dy) );
+  }
+
+}
+
+// i-th element of the van der Corput sequence in the given base, the
+// coordinates of the Halton points
+static double radical_inverse( size_t i, size_t base ) {
+  double x = 0, f = 1.0 / base;
+  for ( ; i; i /= base, f /= base ) x += f * (i % base);
+  return x;
+}
+
+void SoftwareRendererImp::restart_refinement() {
+
+  size_t n = 4 * target_w * target_h;
+  accumulation.assign( render_target, render_target + n );
+  refinement_pass = 1;
+
+}
+
+void SoftwareRendererImp::refine_svg( SVG& svg ) {
+
+  if ( !refinement_pass ) {
+    draw_svg( svg );
+    restart_refinement();
+    return;
+  }
+
+  // Sample the pass at a Halton point within the pixels rather than at
+  // their centers, by moving the svg the other way. The points are
+  // shifted by half a pixel (wrapping around) so that point 0 is the
+  // center the first pass sampled, and pass i takes point i.
+  Matrix3x3 view = svg_2_screen;
+  Matrix3x3 jitter = Matrix3x3::identity();
+  double u = radical_inverse( refinement_pass, 2 ) + 0.5;
+  double v = radical_inverse( refinement_pass, 3 ) + 0.5;
+  jitter(0,2) = 0.5 - (u < 1 ? u : u - 1);
+  jitter(1,2) = 0.5 - (v < 1 ? v : v - 1);
+  svg_2_screen = jitter * view;
+  draw_svg( svg );
+  svg_2_screen = view;
+
+  // add the pass and show the average
+  ++refinement_pass;
+  float scale = 1.0f / refinement_pass;
+  int n = 4 * target_w * target_h;
+  #pragma omp parallel for
+  for ( int i = 0; i < n; ++i ) {
+    accumulation[i] += render_target[i];
+    render_target[i] = (unsigned char) (accumulation[i] * scale + 0.5f);
+  }
+
+}
+
+void SoftwareRendererImp::draw_region( SVG& svg, int x0, int y0,
+                                       int x1, int y1 ) {
+
   // set top level transformation
-  transformation_stack = std::stack<Matrix3x3>();
   transformation = svg_2_screen;
-  
-  // draw all elements
-  for ( size_t i = 0; i < svg.elements.size(); ++i ) {
-    draw_element(svg.elements[i]);
+
+  // only write to the samples of the region
+  scissor_x0 = x0 * sample_rate; scissor_x1 = x1 * sample_rate;
+  scissor_y0 = y0 * sample_rate; scissor_y1 = y1 * sample_rate;
+
+  // in binned mode the primitives are only recorded while walking the
+  // svg and get rasterized tile by tile afterwards
+  binning = binned;
+  if ( binning ) {
+    tiles_x = (target_w + kTileSize - 1) / kTileSize;
+    tiles_y = (target_h + kTileSize - 1) / kTileSize;
+    tile_bins.resize(tiles_x * tiles_y);
+    for ( size_t i = 0; i < tile_bins.size(); ++i ) {
+      tile_bins[i].clear();
+    }
+    primitives.clear();
+    polygon_points.clear();
   }
+  
+  // Draw all elements from the display list. Only the svg to screen
+  // transformation depends on the view, it is composed with the cached
+  // transform of each command when drawing it. Documents are only read
+  // here, several threads draw them at once: the list is compiled when
+  // the document is loaded or edited (SVG::update).
+  assert( svg.display_list.is_compiled() );
+  const DisplayList& list = svg.display_list;
+  const Matrix3x3& m = svg_2_screen;
+  affine = m(2,0) == 0 && m(2,1) == 0 && m(2,2) == 1;
+  root.a = m(0,0); root.c = m(0,1); root.e = m(0,2);
+  root.b = m(1,0); root.d = m(1,1); root.f = m(1,2);
+  bvh = culling ? &svg.bvh : NULL;
+  draw_children( list, NULL, 0, list.root_count, 0 );
+  transformation = svg_2_screen;
 
   // draw canvas outline
   Vector2D a = transform(Vector2D(    0    ,     0    )); a.x--; a.y--;
@@ -40,8 +165,20 @@ void SoftwareRendererImp::draw_svg( SVG& svg ) {
   rasterize_line(d.x, d.y, b.x, b.y, Color::Black);
   rasterize_line(d.x, d.y, c.x, c.y, Color::Black);
 
+  // a cancelled walk may have left samples drawn (or primitives binned)
+  if ( cancelled() ) {
+    binning = false;
+    clear_samples();
+    return;
+  }
+
   // resolve and send to render target
-  resolve();
+  if ( binning ) {
+    binning = false;
+    draw_bins();
+  } else {
+    resolve_region( x0, y0, x1, y1 );
+  }
 
 }
 
@@ -49,15 +186,8 @@ void SoftwareRendererImp::set_sample_rate( size_t sample_rate ) {
 
   // Task 4: 
   // You may want to modify this for supersampling support
-  if(super_sample_buffer){
-    delete[] super_sample_buffer;
-  }
-  ss_target_w =  this->target_w * sample_rate;
-  ss_target_h = this->target_h * sample_rate;
   this->sample_rate = sample_rate;
-  unsigned char* ss_buff = new unsigned char [4 * ss_target_h * ss_target_w];
-  super_sample_buffer = ss_buff;
-  clear_samples();
+  alloc_samples();
   memset((uint8_t*)render_target, 255, 4 * target_h * target_w);
 
 }
@@ -67,22 +197,104 @@ void SoftwareRendererImp::set_render_target( unsigned char* render_target,
 
   // Task 4: 
   // You may want to modify this for supersampling support
-  if(super_sample_buffer){
-    delete[] super_sample_buffer;
-  }
   this->render_target = render_target;
   this->target_w = width;
-  ss_target_w =  width * sample_rate;
   this->target_h = height;
-  ss_target_h = height * sample_rate;
-  unsigned char* ss_buff = new unsigned char [4 * ss_target_w * ss_target_h];
-  super_sample_buffer = ss_buff;
-  clear_samples();
+  alloc_samples();
+}
+
+void SoftwareRendererImp::set_sample_format( SampleFormat format ) {
+
+  if ( format == sample_format ) return;
+  sample_format = format;
+
+  // the buffer is sized once a render target is set
+  if ( ss_target_w ) alloc_samples();
+}
+
+void SoftwareRendererImp::set_msaa( bool msaa ) {
+
+  if ( msaa == this->msaa ) return;
+  this->msaa = msaa;
+  if ( ss_target_w ) alloc_samples();
+}
+
+void SoftwareRendererImp::alloc_samples() {
+
+  coverage_storage = CoverageBuffer();
+  coverage_buffer = &coverage_storage;
+  super_sample_buffer = NULL;
+  refinement_pass = 0;
+  ss_target_w = target_w * sample_rate;
+  ss_target_h = target_h * sample_rate;
+
+  // MSAA storage replaces the sample buffer
+  if ( msaa ) {
+    std::vector<unsigned char>().swap(sample_storage);
+    coverage_buffer->resize(target_w, target_h, sample_rate * sample_rate,
+                            sample_format, kTileSize, kCoverageBudget);
+    return;
+  }
+
+  // cleared to white, opaque in either format
+  size_t size = sample_size(sample_format) * ss_target_w * ss_target_h;
+  sample_storage.assign(size, 255);
+  super_sample_buffer = sample_storage.data();
 }
 
 void SoftwareRendererImp::clear_samples(){
-  //Set alpha to 0
-  memset((uint8_t*)super_sample_buffer, 255, 4 * ss_target_h * ss_target_w);
+  if ( msaa ) {
+    coverage_buffer->clear(0, 0, target_w, target_h);
+    return;
+  }
+
+  // white, opaque in either format
+  memset((uint8_t*)super_sample_buffer, 255, 
+         sample_size(sample_format) * ss_target_h * ss_target_w);
+}
+
+inline unsigned char* SoftwareRendererImp::sample_ptr( int x, int y ) {
+  return super_sample_buffer + 
+         sample_size(sample_format) * (x + (size_t) y * ss_target_w);
+}
+
+// snap a sample space coordinate to the fixed point subpixel grid
+static inline int64_t snap( float v ) {
+  return (int64_t) floor((double) v * (1 << kSubpixelBits) + 0.5);
+}
+
+// integer division rounding towards -infinity / +infinity
+static inline int64_t floor_div( int64_t a, int64_t b ) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static inline int64_t ceil_div( int64_t a, int64_t b ) {
+  return -floor_div(-a, b);
+}
+
+// Liang-Barsky: clip segment (x0,y0)-(x1,y1) to [xmin,xmax]x[ymin,ymax],
+// false if nothing (finite) is left. Ends inside the box are kept unchanged.
+static bool clip_line( float& x0, float& y0, float& x1, float& y1,
+                       float xmin, float ymin, float xmax, float ymax ) {
+
+  double dx = (double) x1 - x0, dy = (double) y1 - y0;
+  if (!(isfinite(dx) && isfinite(dy))) return false;
+  double p[4] = { -dx, dx, -dy, dy };
+  double q[4] = { x0 - (double) xmin, xmax - (double) x0,
+                  y0 - (double) ymin, ymax - (double) y0 };
+  double t0 = 0, t1 = 1;
+  for (int i = 0; i < 4; i++) {
+    if (!(q[i] >= 0 || p[i] != 0)) return false; // parallel and outside
+    if (p[i] == 0) continue;
+    double t = q[i] / p[i];
+    if (p[i] < 0) t0 = max(t0, t); else t1 = min(t1, t);
+  }
+  if (!(t0 <= t1)) return false;
+
+  double sx = x0, sy = y0;
+  if (t1 < 1) { x1 = sx + t1 * dx; y1 = sy + t1 * dy; }
+  if (t0 > 0) { x0 = sx + t0 * dx; y0 = sy + t0 * dy; }
+  return true;
 }
 
 Vector2D vec3Dto2D (Vector3D vector){
@@ -97,101 +309,165 @@ Vector2D transformPoint(Matrix3x3 transformation, Vector2D point){
   return vec3Dto2D(transformation * vec2Dto3D(point));
 }
 
-void SoftwareRendererImp::draw_element( SVGElement* element ) {
+void SoftwareRendererImp::draw_children( const DisplayList& list,
+                                         const Group* group,
+                                         size_t first, size_t count,
+                                         uint32_t transform ) {
+
+  // the view (the pixels of the scissor) is grown by the margin lines
+  // and points write around their end points
+  BBox2D view;
+  view.expand( Vector2D( scissor_x0 / sample_rate - 2.0,
+                         scissor_y0 / sample_rate - 2.0 ) );
+  view.expand( Vector2D( scissor_x1 / sample_rate + 2.0,
+                         scissor_y1 / sample_rate + 2.0 ) );
+
+  vector<size_t> visible;
+  Matrix3x3 to_screen = svg_2_screen * list.transforms[transform].to_matrix();
+  if ( !bvh || !bvh->query( group, to_screen, view, visible ) ) {
+    for ( size_t i = 0; i < count; ++i ) {
+      draw_command( list, list.children[first + i] );
+    }
+    return;
+  }
 
-  // Task 5 (part 1):
-  // Modify this to implement the transformation stack
+  for ( size_t i = 0; i < visible.size(); ++i ) {
+    draw_command( list, list.children[first + visible[i]] );
+  }
+}
+
+void SoftwareRendererImp::draw_command( const DisplayList& list,
+                                        uint32_t index ) {
+
+  if ( cancelled() ) return;
 
-  transformation_stack.push(transformation);
-  transformation = transformation * element->transform;
-  switch(element->type) {
+  const DisplayCommand& cmd = list.commands[index];
+  const Vector2D* p = list.points.data() + cmd.first;
+  if ( cmd.kind != GROUP ) set_transform( list.transforms[cmd.transform] );
+
+  switch ( cmd.kind ) {
     case POINT:
-      draw_point(static_cast<Point&>(*element));
+      draw_point( cmd, p );
       break;
     case LINE:
-      draw_line(static_cast<Line&>(*element));
+      draw_line( cmd, p );
       break;
     case POLYLINE:
-      draw_polyline(static_cast<Polyline&>(*element));
+      draw_polyline( cmd, p );
       break;
     case RECT:
-      draw_rect(static_cast<Rect&>(*element));
+      draw_rect( cmd, p );
       break;
     case POLYGON:
-      draw_polygon(static_cast<Polygon&>(*element));
+      draw_polygon( cmd, p, list.indices.data() + cmd.tri_first );
       break;
     case ELLIPSE:
-      draw_ellipse(static_cast<Ellipse&>(*element));
+      draw_ellipse( cmd, p );
       break;
     case IMAGE:
-      draw_image(static_cast<Image&>(*element));
+      draw_image( cmd, p );
       break;
     case GROUP:
-      draw_group(static_cast<Group&>(*element));
+      draw_children( list, static_cast<const Group*>(cmd.element),
+                     cmd.first, cmd.count, cmd.transform );
       break;
     default:
       break;
   }
-  transformation = transformation_stack.top();
-  transformation_stack.pop();
 }
 
 
+void SoftwareRendererImp::set_transform( const Affine2D& m ) {
+
+  if ( !affine ) {
+    transformation = svg_2_screen * m.to_matrix();
+    return;
+  }
+
+  // screen = root * m, in double precision
+  screen.a = root.a * m.a + root.c * m.b;
+  screen.b = root.b * m.a + root.d * m.b;
+  screen.c = root.a * m.c + root.c * m.d;
+  screen.d = root.b * m.c + root.d * m.d;
+  screen.e = root.a * m.e + root.c * m.f + root.e;
+  screen.f = root.b * m.e + root.d * m.f + root.f;
+}
+
+void SoftwareRendererImp::to_screen( const Vector2D* points, size_t n,
+                                     vector<Vector2D>& out ) {
+
+  out.resize( n );
+  if ( n == 0 ) return;
+
+  if ( !affine ) {
+    for (size_t i = 0; i < n; i++) out[i] = transform( points[i] );
+    return;
+  }
+
+  // the kernel works on interleaved x, y pairs
+  static_assert( sizeof(Vector2D) == 2 * sizeof(double),
+                 "Vector2D must be two packed doubles" );
+  const double m[6] = { screen.a, screen.b, screen.c,
+                        screen.d, screen.e, screen.f };
+  raster_kernels().transform_points( m, &points[0].x, &out[0].x, n );
+}
+
 // Primitive Drawing //
 
-void SoftwareRendererImp::draw_point( Point& point ) {
+void SoftwareRendererImp::draw_point( const DisplayCommand& cmd,
+                                      const Vector2D* points ) {
 
-  Vector2D p = transform(point.position);
-  rasterize_point( p.x, p.y, point.style.fillColor );
+  Vector2D p = to_screen(points[0]);
+  rasterize_point( p.x, p.y, cmd.fill );
 
 }
 
-void SoftwareRendererImp::draw_line( Line& line ) { 
+void SoftwareRendererImp::draw_line( const DisplayCommand& cmd,
+                                     const Vector2D* points ) {
 
-  Vector2D p0 = transform(line.from);
-  Vector2D p1 = transform(line.to);
-  rasterize_line( p0.x, p0.y, p1.x, p1.y, line.style.strokeColor );
+  Vector2D p0 = to_screen(points[0]);
+  Vector2D p1 = to_screen(points[1]);
+  rasterize_line( p0.x, p0.y, p1.x, p1.y, cmd.stroke );
 
 }
 
-void SoftwareRendererImp::draw_polyline( Polyline& polyline ) {
+void SoftwareRendererImp::draw_polyline( const DisplayCommand& cmd,
+                                         const Vector2D* points ) {
 
-  Color c = polyline.style.strokeColor;
+  Color c = cmd.stroke;
 
   if( c.a != 0 ) {
-    int nPoints = polyline.points.size();
-    for( int i = 0; i < nPoints - 1; i++ ) {
-      Vector2D p0 = transform(polyline.points[(i+0) % nPoints]);
-      Vector2D p1 = transform(polyline.points[(i+1) % nPoints]);
-      rasterize_line( p0.x, p0.y, p1.x, p1.y, c );
+    to_screen( points, cmd.count, screen_points );
+    const Vector2D* p = screen_points.data();
+    for( int i = 0; i < (int) cmd.count - 1; i++ ) {
+      rasterize_line( p[i].x, p[i].y, p[i+1].x, p[i+1].y, c );
     }
   }
 }
 
-void SoftwareRendererImp::draw_rect( Rect& rect ) {
+void SoftwareRendererImp::draw_rect( const DisplayCommand& cmd,
+                                     const Vector2D* points ) {
 
   Color c;
   
   // draw as two triangles
-  float x = rect.position.x;
-  float y = rect.position.y;
-  float w = rect.dimension.x;
-  float h = rect.dimension.y;
-
-  Vector2D p0 = transform(Vector2D(   x   ,   y   ));
-  Vector2D p1 = transform(Vector2D( x + w ,   y   ));
-  Vector2D p2 = transform(Vector2D(   x   , y + h ));
-  Vector2D p3 = transform(Vector2D( x + w , y + h ));
+  Vector2D p0 = to_screen(points[0]);
+  Vector2D p1 = to_screen(points[1]);
+  Vector2D p2 = to_screen(points[2]);
+  Vector2D p3 = to_screen(points[3]);
   
   // draw fill
-  c = rect.style.fillColor;
-  if (c.a != 0 ) {
+  c = cmd.fill;
+  if (c.a != 0 && analytic && !msaa) {
+    Vector2D outline[4] = { p0, p1, p3, p2 };
+    rasterize_polygon( outline, 4, NONZERO, c );
+  } else if (c.a != 0 ) {
     rasterize_triangle( p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, c );
     rasterize_triangle( p2.x, p2.y, p1.x, p1.y, p3.x, p3.y, c );
   }
 
   // draw outline
-  c = rect.style.strokeColor;
+  c = cmd.stroke;
   if( c.a != 0 ) {
     rasterize_line( p0.x, p0.y, p1.x, p1.y, c );
     rasterize_line( p1.x, p1.y, p3.x, p3.y, c );
@@ -201,59 +477,65 @@ void SoftwareRendererImp::draw_rect( Rect& rect ) {
 
 }
 
-void SoftwareRendererImp::draw_polygon( Polygon& polygon ) {
+void SoftwareRendererImp::draw_polygon( const DisplayCommand& cmd,
+                                        const Vector2D* points,
+                                        const uint32_t* triangles ) {
 
   Color c;
 
+  // the outline is mapped once, for both fill and stroke
+  if ( cmd.fill.a != 0 || cmd.stroke.a != 0 ) {
+    to_screen( points, cmd.count, screen_points );
+  }
+  const Vector2D* p = screen_points.data();
+  int nPoints = cmd.count;
+
   // draw fill
-  c = polygon.style.fillColor;
+  c = cmd.fill;
   if( c.a != 0 ) {
 
-    // triangulate
-    vector<Vector2D> triangles;
-    triangulate( polygon, triangles );
+    // draw the triangulation from the display list, unless the outline
+    // is filled directly or has no triangles (it is not simple)
+    bool direct = scanline || (analytic && !msaa) || cmd.tri_count == 0;
+
+    if ( direct && nPoints > 0 ) {
+      rasterize_polygon( p, nPoints, (FillRule) cmd.rule, c );
+    }
 
     // draw as triangles
-    for (size_t i = 0; i < triangles.size(); i += 3) {
-      Vector2D p0 = transform(triangles[i + 0]);
-      Vector2D p1 = transform(triangles[i + 1]);
-      Vector2D p2 = transform(triangles[i + 2]);
+    for (size_t i = 0; !direct && i < cmd.tri_count; i += 3) {
+      const Vector2D& p0 = p[triangles[i + 0]];
+      const Vector2D& p1 = p[triangles[i + 1]];
+      const Vector2D& p2 = p[triangles[i + 2]];
       rasterize_triangle( p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, c );
     }
   }
 
   // draw outline
-  c = polygon.style.strokeColor;
+  c = cmd.stroke;
   if( c.a != 0 ) {
-    int nPoints = polygon.points.size();
     for( int i = 0; i < nPoints; i++ ) {
-      Vector2D p0 = transform(polygon.points[(i+0) % nPoints]);
-      Vector2D p1 = transform(polygon.points[(i+1) % nPoints]);
+      const Vector2D& p0 = p[i];
+      const Vector2D& p1 = p[(i+1) % nPoints];
       rasterize_line( p0.x, p0.y, p1.x, p1.y, c );
     }
   }
 }
 
-void SoftwareRendererImp::draw_ellipse( Ellipse& ellipse ) {
+void SoftwareRendererImp::draw_ellipse( const DisplayCommand& /*cmd*/,
+                                        const Vector2D* /*points*/ ) {
 
   // Extra credit 
 
 }
 
-void SoftwareRendererImp::draw_image( Image& image ) {
+void SoftwareRendererImp::draw_image( const DisplayCommand& cmd,
+                                      const Vector2D* points ) {
 
-  Vector2D p0 = transform(image.position);
-  Vector2D p1 = transform(image.position + image.dimension);
-
-  rasterize_image( p0.x, p0.y, p1.x, p1.y, image.tex );
-}
-
-void SoftwareRendererImp::draw_group( Group& group ) {
-
-  for ( size_t i = 0; i < group.elements.size(); ++i ) {
-    draw_element(group.elements[i]);
-  }
+  Vector2D p0 = to_screen(points[0]);
+  Vector2D p1 = to_screen(points[1]);
 
+  rasterize_image( p0.x, p0.y, p1.x, p1.y, *cmd.tex );
 }
 
 // Rasterization //
@@ -263,16 +545,36 @@ void SoftwareRendererImp::draw_group( Group& group ) {
 
 void SoftwareRendererImp::rasterize_point( float x, float y, Color color ) {
 
+  if ( binning ) {
+    BinnedPrimitive p( BinnedPrimitive::POINT, x, y );
+    p.color = color;
+    bin_primitive( p, floor(x), floor(y), floor(x), floor(y) );
+    return;
+  }
+
   // fill in the nearest pixel
   int sx = (int) floor(x);
   int sy = (int) floor(y);
 
-  if ( sx < 0 || sx >= target_w ) return;
-  if ( sy < 0 || sy >= target_h ) return;
+  if ( sx < 0 || sx >= (int) target_w ) return;
+  if ( sy < 0 || sy >= (int) target_h ) return;
+
+  // MSAA takes all samples of the pixel in one write, which keeps it a
+  // single fragment instead of expanding it sample by sample (the scissor
+  // is whole pixels)
+  if ( msaa ) {
+    int fx = sx * sample_rate, fy = sy * sample_rate;
+    if ( fx < scissor_x0 || fx >= scissor_x1 ) return;
+    if ( fy < scissor_y0 || fy >= scissor_y1 ) return;
+    SampleColor c = quantize(color, sample_format);
+    if ( c.transparent() ) return;
+    coverage_buffer->blend(sx, sy, ~(uint64_t) 0, c, color);
+    return;
+  }
 
   //Note: no need to manage alpha in buffer since it always starts at 255
-  for (int i =0; i < sample_rate; i++){
-    for (int j = 0; j < sample_rate; j++){
+  for (int i =0; i < (int) sample_rate; i++){
+    for (int j = 0; j < (int) sample_rate; j++){
       int fx = sx * sample_rate + i;
       int fy = sy * sample_rate + j;
       rasterize_sample(fx, fy, color);
@@ -286,28 +588,39 @@ void SoftwareRendererImp::rasterize_sample( float x, float y, Color color ) {
   int sx = (int) floor(x);
   int sy = (int) floor(y);
 
-  if ( sx < 0 || sx >= ss_target_w ) return;
-  if ( sy < 0 || sy >= ss_target_h ) return;
+  if ( sx < scissor_x0 || sx >= scissor_x1 ) return;
+  if ( sy < scissor_y0 || sy >= scissor_y1 ) return;
 
-  //Note: no need to manage alpha in buffer since it always starts at 255
-  Color originalColor = Color(
-      (float)(super_sample_buffer[4 * (sx + sy * ss_target_w)]) / 255.0f,
-      (float)(super_sample_buffer[4 * (sx + sy * ss_target_w) + 1]) / 255.0f,
-      (float)(super_sample_buffer[4 * (sx + sy * ss_target_w) + 2]) / 255.0f,
-      (float)(super_sample_buffer[4 * (sx + sy * ss_target_w) + 3]) / 255.0f);
-  color.r *= color.a;
-  color.g *= color.a;
-  color.b *= color.a;
-  super_sample_buffer[4 * (sx + sy * ss_target_w)] = (uint8_t)((((1 - color.a) * originalColor.r) + color.r) * 255);
-  super_sample_buffer[4 * (sx + sy * ss_target_w) + 1] = (uint8_t)((((1 - color.a) * originalColor.g) + color.g) * 255);
-  super_sample_buffer[4 * (sx + sy * ss_target_w) + 2] = (uint8_t)((((1 - color.a) * originalColor.b) + color.b) * 255);
-  super_sample_buffer[4 * (sx + sy * ss_target_w) + 3] = (uint8_t)(255);
+  SampleColor c = quantize(color, sample_format);
+  if ( c.transparent() ) return;
+  if ( msaa ) {
+    int bit = (sy % sample_rate) * sample_rate + sx % sample_rate;
+    coverage_buffer->blend(sx / sample_rate, sy / sample_rate, 1ull << bit,
+                          c, color);
+    return;
+  }
+  blend_sample(sample_ptr(sx, sy), c, sample_format);
 }
 
 void SoftwareRendererImp::rasterize_line( float x0, float y0,
                                           float x1, float y1,
                                           Color color) {
 
+  if ( binning ) {
+    BinnedPrimitive p( BinnedPrimitive::LINE, x0, y0, x1, y1 );
+    p.color = color;
+    bin_primitive( p, floor(min(x0, x1)) - 2, floor(min(y0, y1)) - 2,
+                       ceil (max(x0, x1)) + 2, ceil (max(y0, y1)) + 2 );
+    return;
+  }
+
+  // Clip to the target grown by a margin, the pixels written around a
+  // clipped end then all lie off screen. Every tile clips against the
+  // whole target, so binned and serial passes walk the same line.
+  const float margin = 2;
+  if ( !clip_line( x0, y0, x1, y1, -margin, -margin,
+                   target_w + margin, target_h + margin ) ) return;
+
   // Task 2: 
   // Implement line rasterization
   // transform coords so center of pixels are (0, 0)
@@ -376,28 +689,29 @@ void SoftwareRendererImp::rasterize_line( float x0, float y0,
   }
 
   
-  float yIntersect = yStart + gradient;
-  float yIntersectFract = yIntersect - floor(yIntersect);
-  if (ySteep) {
-     for (float x = xPixel0 + 1; x < xPixel1; x++){
-       rasterize_point(floor(yIntersect), x, color * (1 - (yIntersectFract)));
-       for(float i = 1; i < WIDTH; i++){
-         rasterize_point(floor(yIntersect) + i, x, color);
-       }
-       rasterize_point(floor(yIntersect) + WIDTH, x, color * yIntersectFract);
-       yIntersect += gradient;
-       yIntersectFract = yIntersect - floor(yIntersect);
-     }
-  }else{    
-    for (float x = xPixel0 + 1; x < xPixel1; x++){
-       rasterize_point(x, floor(yIntersect), color * (1 - (yIntersectFract)));
-       for(float i = 1; i < WIDTH; i++){
-         rasterize_point(x, floor(yIntersect) + i, color);
-       }
-       rasterize_point(x, floor(yIntersect) + WIDTH, color * yIntersectFract);
-       yIntersect += gradient;
-       yIntersectFract = yIntersect - floor(yIntersect);
-     }
+  // Walk the interior pixels within the scissor along the major axis.
+  // y is computed from the start of the line, so skipped pixels do not
+  // change the result.
+  float first = max(xPixel0 + 1, ySteep ? floor((float) scissor_y0 / sample_rate)
+                                        : floor((float) scissor_x0 / sample_rate));
+  float last  = min((float) xPixel1, ySteep ? ceil((float) scissor_y1 / sample_rate)
+                                            : ceil((float) scissor_x1 / sample_rate));
+  for (float x = first; x < last; x++){
+    float yIntersect = yStart + gradient * (x - xPixel0);
+    float yIntersectFract = yIntersect - floor(yIntersect);
+    if (ySteep) {
+      rasterize_point(floor(yIntersect), x, color * (1 - (yIntersectFract)));
+      for(float i = 1; i < WIDTH; i++){
+        rasterize_point(floor(yIntersect) + i, x, color);
+      }
+      rasterize_point(floor(yIntersect) + WIDTH, x, color * yIntersectFract);
+    } else {
+      rasterize_point(x, floor(yIntersect), color * (1 - (yIntersectFract)));
+      for(float i = 1; i < WIDTH; i++){
+        rasterize_point(x, floor(yIntersect) + i, color);
+      }
+      rasterize_point(x, floor(yIntersect) + WIDTH, color * yIntersectFract);
+    }
   }
 }
 
@@ -405,56 +719,538 @@ void SoftwareRendererImp::rasterize_triangle( float x0, float y0,
                                               float x1, float y1,
                                               float x2, float y2,
                                               Color color ) {
+  // fully transparent fills (common in svg exports) are dropped early
+  if ( quantize(color, sample_format).transparent() ) return;
+
+  if ( binning ) {
+    BinnedPrimitive p( BinnedPrimitive::TRIANGLE, x0, y0, x1, y1, x2, y2 );
+    p.color = color;
+    bin_primitive( p, floor(min(x0, min(x1, x2))) - 1,
+                      floor(min(y0, min(y1, y2))) - 1,
+                      ceil (max(x0, max(x1, x2))) + 1,
+                      ceil (max(y0, max(y1, y2))) + 1 );
+    return;
+  }
+
   // Task 3: 
   // Implement triangle rasterization
-  // transform coords so center of pixels are (0, 0)
-  x0 -= 0.5f;
-  x1 -= 0.5f;
-  x2 -= 0.5f;
-  y2 -= 0.5f;
-  y1 -= 0.5f;
-  y0 -= 0.5f;
-  x0 *= sample_rate;
-  x1 *= sample_rate;
-  x2 *= sample_rate;
-  y0 *= sample_rate;
-  y1 *= sample_rate;
-  y2 *= sample_rate;
-  float maxX = floor(max(x0, max(x1, x2)) + 0.5f);
-  float minX = floor(min(x0, min(x1, x2)) + 0.5f);
-  float maxY = floor(max(y0, max(y1, y2)) + 0.5f);
-  float minY = floor(min(y0, min(y1, y2)) + 0.5f);
-  Vector2D vec0 = Vector2D((x1 - x0), (y1 - y0));
-  Vector2D vec1 = Vector2D((x2 - x1), (y2 - y1));
-  Vector2D vec2 = Vector2D((x0 - x2), (y0 - y2));
-  bool isCounterClockwise = cross(vec0, -1 * vec2) > 0;
-
-  for (int x = minX; x < maxX + 1; x++){
-    for (int y = minY; y < maxY + 1; y++){
-      bool doesContain = false;
-      if (isCounterClockwise)
-      {
-        doesContain = cross(Vector2D(x - x0, y - y0), vec0) <= 0 
-        && cross(Vector2D(x - x1, y - y1), vec1) <= 0 
-        && cross(Vector2D(x - x2, y - y2), vec2) <= 0;
+  // transform coords so center of samples are (0, 0), sample (i, j) of
+  // pixel (x, y) sits at (x + (i + 0.5) / sample_rate, ...) like the
+  // sample cells of rasterize_polygon
+  x0 = x0 * sample_rate - 0.5f;
+  x1 = x1 * sample_rate - 0.5f;
+  x2 = x2 * sample_rate - 0.5f;
+  y0 = y0 * sample_rate - 0.5f;
+  y1 = y1 * sample_rate - 0.5f;
+  y2 = y2 * sample_rate - 0.5f;
+
+  // triangles reaching far outside the target are clipped to the guard
+  // band first, so that the fixed point edge functions cannot overflow
+  if ( !(isfinite(x0) && isfinite(y0) && isfinite(x1) &&
+         isfinite(y1) && isfinite(x2) && isfinite(y2)) ) return;
+  if ( fabs(x0) <= kGuardBand && fabs(y0) <= kGuardBand &&
+       fabs(x1) <= kGuardBand && fabs(y1) <= kGuardBand &&
+       fabs(x2) <= kGuardBand && fabs(y2) <= kGuardBand ) {
+    fill_triangle( x0, y0, x1, y1, x2, y2, color );
+    return;
+  }
+
+  vector<Vector2D> poly;
+  poly.push_back(Vector2D(x0, y0));
+  poly.push_back(Vector2D(x1, y1));
+  poly.push_back(Vector2D(x2, y2));
+  clip_to_guard_band( poly );
+
+  // the fan triangles share snapped vertices, so their common edges are
+  // covered exactly once
+  for (size_t i = 2; i < poly.size(); i++) {
+    fill_triangle( poly[0    ].x, poly[0    ].y,
+                   poly[i - 1].x, poly[i - 1].y,
+                   poly[i    ].x, poly[i    ].y, color );
+  }
+
+}
+
+void SoftwareRendererImp::fill_triangle( float x0, float y0,
+                                         float x1, float y1,
+                                         float x2, float y2,
+                                         Color color ) {
+
+  // snap vertices to the subpixel grid, sample (x, y) sits at
+  // (x * one, y * one) in fixed point
+  const int64_t one = 1 << kSubpixelBits;
+  int64_t X[3] = { snap(x0), snap(x1), snap(x2) };
+  int64_t Y[3] = { snap(y0), snap(y1), snap(y2) };
+
+  // zero area triangles cover nothing; otherwise orient the triangle so
+  // that the interior is on the non-negative side of every edge
+  int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+  if (area == 0) return;
+  if (area < 0) { swap(X[1], X[2]); swap(Y[1], Y[2]); }
+
+  // covered sample range, clamped to the scissor
+  int minX = max((int) ceil_div(min(X[0], min(X[1], X[2])), one), scissor_x0);
+  int minY = max((int) ceil_div(min(Y[0], min(Y[1], Y[2])), one), scissor_y0);
+  int maxX = min((int) floor_div(max(X[0], max(X[1], X[2])), one), scissor_x1 - 1);
+  int maxY = min((int) floor_div(max(Y[0], max(Y[1], Y[2])), one), scissor_y1 - 1);
+  if (minX > maxX || minY > maxY) return;
+
+  // Edge i runs from vertex i to vertex i + 1. Its edge function is
+  // stepped incrementally by stepX / stepY per sample. Samples exactly on
+  // an edge belong to the triangle only if it is a top or left edge
+  // (top-left rule), so meshes are watertight and every sample shared by
+  // two triangles is written once.
+  int64_t stepX[3], stepY[3], rowE[3];
+  for (int i = 0; i < 3; i++) {
+    int j = (i + 1) % 3;
+    int64_t dx = X[j] - X[i];
+    int64_t dy = Y[j] - Y[i];
+    bool top_left = dy < 0 || (dy == 0 && dx > 0);
+    stepX[i] = -dy * one;
+    stepY[i] =  dx * one;
+    rowE[i]  = dx * (minY * one - Y[i]) - dy * (minX * one - X[i])
+             - (top_left ? 0 : 1);
+  }
+
+  // quantize once, fully transparent triangles leave no trace
+  SampleColor c = quantize(color, sample_format);
+  if ( c.transparent() ) return;
+  if ( msaa ) {
+    fill_coverage(minX, minY, maxX, maxY, stepX, stepY, rowE, c, color);
+    return;
+  }
+  const RasterKernels& kernels = raster_kernels();
+
+  // Edge functions are linear, so their extrema over a block lie on the
+  // block corners. Blocks with all corners inside every edge are filled
+  // as spans, blocks with all corners outside one edge are skipped.
+  for (int by = minY; by <= maxY; by += kBlockSize) {
+    int bye = min(by + kBlockSize - 1, maxY);
+    for (int bx = minX; bx <= maxX; bx += kBlockSize) {
+      int bxe = min(bx + kBlockSize - 1, maxX);
+
+      int64_t E[3];
+      bool accept = true, reject = false;
+      for (int i = 0; i < 3 && !reject; i++) {
+        E[i] = rowE[i] + (bx - minX) * stepX[i];
+        int64_t w = (bxe - bx) * stepX[i];
+        int64_t h = (bye - by) * stepY[i];
+        int n = (E[i] >= 0) + (E[i] + w >= 0) +
+                (E[i] + h >= 0) + (E[i] + w + h >= 0);
+        if (n == 0) reject = true;
+        if (n <  4) accept = false;
+      }
+      if (reject) continue;
+
+      if (accept) {
+        for (int y = by; y <= bye; y++) {
+          kernels.blend_span[sample_format](sample_ptr(bx, y), bxe - bx + 1, c);
+        }
+        continue;
+      }
+
+      // Partially covered block, test each sample: k * stepX >= -E. The
+      // left side is exact in double; when -E is too large to be exact
+      // its sign alone decides the test, which rounding preserves.
+      double cx[3 * kBlockSize];
+      for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < kBlockSize; k++) {
+          cx[kBlockSize * i + k] = (double) (k * stepX[i]);
+        }
+      }
+      for (int y = by; y <= bye; y++) {
+        double ry[3];
+        for (int i = 0; i < 3; i++) {
+          ry[i] = (double) -(E[i] + (y - by) * stepY[i]);
+        }
+        unsigned mask = kernels.coverage(cx, ry, bxe - bx + 1);
+        if (mask) {
+          kernels.blend_mask[sample_format](sample_ptr(bx, y), mask, c);
+        }
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      rowE[i] += kBlockSize * stepY[i];
+    }
+  }
+
+}
+
+void SoftwareRendererImp::fill_coverage( int minX, int minY,
+                                         int maxX, int maxY,
+                                         const int64_t* stepX,
+                                         const int64_t* stepY,
+                                         const int64_t* rowE,
+                                         const SampleColor& c,
+                                         const Color& color ) {
+
+  const RasterKernels& kernels = raster_kernels();
+  int sr = sample_rate;
+  int px0 = minX / sr, px1 = maxX / sr;
+  vector<uint64_t> masks(px1 - px0 + 1);
+
+  double cx[3 * kBlockSize];
+  for (int i = 0; i < 3; i++) {
+    for (int k = 0; k < kBlockSize; k++) {
+      cx[kBlockSize * i + k] = (double) (k * stepX[i]);
+    }
+  }
+
+  // gather the coverage of each row of pixels, sample row by sample row,
+  // then write each pixel once so it keeps as few fragments as possible
+  for (int py = minY / sr; py <= maxY / sr; py++) {
+    int y0 = max(py * sr, minY), y1 = min(py * sr + sr - 1, maxY);
+    for (int y = y0; y <= y1; y++) {
+      int64_t E[3];
+      for (int i = 0; i < 3; i++) E[i] = rowE[i] + (y - minY) * stepY[i];
+      for (int bx = minX; bx <= maxX; bx += kBlockSize) {
+        double ry[3];
+        for (int i = 0; i < 3; i++) {
+          ry[i] = (double) -(E[i] + (bx - minX) * stepX[i]);
+        }
+        unsigned mask = kernels.coverage(cx, ry, min(kBlockSize, maxX - bx + 1));
+        for (int k = 0; mask; k++, mask >>= 1) {
+          if (!(mask & 1)) continue;
+          int x = bx + k;
+          masks[x / sr - px0] |= 1ull << ((y % sr) * sr + x % sr);
+        }
       }
-      else
-      {
-        doesContain = cross(Vector2D(x - x0, y - y0), vec0) >= 0 
-        && cross(Vector2D(x - x1, y - y1), vec1) >= 0 
-        && cross(Vector2D(x - x2, y - y2), vec2) >= 0;
+    }
+    flush_coverage(px0, py, &masks[0], masks.size(), c, color);
+  }
+}
+
+void SoftwareRendererImp::clip_to_guard_band( vector<Vector2D>& poly ) {
+
+  // Sutherland-Hodgman against the four sides of the guard band
+  for (int side = 0; side < 4; side++) {
+    int axis = side % 2;
+    double sign  = side < 2 ? 1 : -1;
+    vector<Vector2D> out;
+    for (size_t i = 0; i < poly.size(); i++) {
+      const Vector2D& a = poly[i];
+      const Vector2D& b = poly[(i + 1) % poly.size()];
+      double da = kGuardBand - sign * (axis ? a.y : a.x);
+      double db = kGuardBand - sign * (axis ? b.y : b.x);
+      if (da >= 0) out.push_back(a);
+      if ((da >= 0) != (db >= 0)) {
+        out.push_back(a + (b - a) * (da / (da - db)));
       }
-      if(doesContain){
-        rasterize_sample(x, y, color);
+    }
+    poly.swap(out);
+  }
+}
+
+// Accumulate the signed area of edge (x0,y0)-(x1,y1) into the cells it
+// crosses and the remaining height (cover) into the cell to its right, so
+// that a running sum along each row gives the winding weighted coverage
+// of every cell. x must lie in [0,w]; only rows [r0,r1) are accumulated,
+// into rows of w + 2 cells starting at area, widening the touched range
+// [span[2 * row], span[2 * row + 1]] of each row. Each row is computed
+// from the endpoints alone, so the result does not depend on [r0,r1).
+static void accumulate_edge( float* area, int* span, int w, int r0, int r1,
+                             double x0, double y0, double x1, double y1 ) {
+
+  if (y0 == y1) return;
+  float dir = 1;
+  if (y0 > y1) { swap(x0, x1); swap(y0, y1); dir = -1; }
+
+  double dxdy = (x1 - x0) / (y1 - y0);
+  int ys = (int) max((double) r0, floor(y0));
+  int ye = (int) min((double) r1, ceil(y1));
+  for (int y = ys; y < ye; y++) {
+    float* row = area + (y - r0) * (w + 2);
+    double top = max((double) y, y0), bottom = min((double) (y + 1), y1);
+    float x = x0 + (top - y0) * dxdy;
+    float xnext = x0 + (bottom - y0) * dxdy;
+    float d = (bottom - top) * dir;
+
+    float xa = min(x, xnext), xb = max(x, xnext);
+    float xa_floor = floor(xa), xb_ceil = ceil(xb);
+    int xai = (int) xa_floor, xbi = (int) xb_ceil;
+    int* touched = span + 2 * (y - r0);
+    touched[0] = min(touched[0], xai);
+    touched[1] = max(touched[1], max(xbi, xai + 1));
+    if (xbi <= xai + 1) {
+      // inside one cell, split by the mean x
+      float xm = 0.5f * (x + xnext) - xa_floor;
+      row[xai]     += d - d * xm;
+      row[xai + 1] += d * xm;
+    } else {
+      // across several cells, the area grows linearly in between
+      float s = 1 / (xb - xa);
+      float xaf = xa - xa_floor;
+      float xbf = xb - xb_ceil + 1;
+      float a0 = 0.5f * s * (1 - xaf) * (1 - xaf);
+      float am = 0.5f * s * xbf * xbf;
+      row[xai] += d * a0;
+      if (xbi == xai + 2) {
+        row[xai + 1] += d * (1 - a0 - am);
+      } else {
+        float a1 = s * (1.5f - xaf);
+        row[xai + 1] += d * (a1 - a0);
+        for (int xi = xai + 2; xi < xbi - 1; xi++) row[xi] += d * s;
+        float a2 = a1 + (xbi - xai - 3) * s;
+        row[xbi - 1] += d * (1 - a2 - am);
       }
-   }
+      row[xbi] += d * am;
+    }
   }
+}
 
+// Split an edge where it leaves the columns [0,w] and accumulate the
+// parts. Parts left of the window keep their cover and move onto x = 0,
+// parts right of it move onto x = w where they do not affect any cell.
+static void accumulate_clipped( float* area, int* span, int w, int r0, int r1,
+                                double x0, double y0, double x1, double y1 ) {
+
+  if (y0 == y1 || max(y0, y1) <= r0 || min(y0, y1) >= r1) return;
+
+  double t[4] = { 0, 1 };
+  int n = 2;
+  if ((x0 < 0) != (x1 < 0)) t[n++] = -x0 / (x1 - x0);
+  if ((x0 > w) != (x1 > w)) t[n++] = (w - x0) / (x1 - x0);
+  sort(t, t + n);
+  for (int i = 0; i + 1 < n; i++) {
+    double xa = x0 + t[i]     * (x1 - x0), ya = y0 + t[i]     * (y1 - y0);
+    double xb = x0 + t[i + 1] * (x1 - x0), yb = y0 + t[i + 1] * (y1 - y0);
+    accumulate_edge(area, span, w, r0, r1, min(max(xa, 0.0), (double) w), ya,
+                                           min(max(xb, 0.0), (double) w), yb);
+  }
+}
+
+void SoftwareRendererImp::rasterize_polygon( const Vector2D* points,
+                                             size_t count, FillRule rule,
+                                             Color color ) {
+
+  if ( count < 3 ) return;
+  SampleColor c = quantize(color, sample_format);
+  if ( c.transparent() ) return;
+
+  // sample cell bounds of the outline
+  double minx = points[0].x, maxx = minx, miny = points[0].y, maxy = miny;
+  for (size_t i = 1; i < count; i++) {
+    minx = min(minx, points[i].x); maxx = max(maxx, points[i].x);
+    miny = min(miny, points[i].y); maxy = max(maxy, points[i].y);
+  }
+  if ( !isfinite(minx + maxx + miny + maxy) ) return;
+
+  if ( binning ) {
+    BinnedPrimitive p( BinnedPrimitive::POLYGON );
+    p.color = color;
+    p.first = polygon_points.size();
+    p.count = count;
+    p.rule = rule;
+    polygon_points.insert(polygon_points.end(), points, points + count);
+    bin_primitive( p, floor(minx), floor(miny), floor(maxx), floor(maxy) );
+    return;
+  }
+
+  if ( analytic && !msaa ) {
+    fill_polygon_area( points, count, rule, minx, miny, maxx, maxy, c, color );
+  } else {
+    fill_polygon_scanline( points, count, rule, c, color );
+  }
+}
+
+void SoftwareRendererImp::fill_polygon_area( const Vector2D* points,
+                                             size_t count, FillRule rule,
+                                             double minx, double miny,
+                                             double maxx, double maxy,
+                                             const SampleColor& c,
+                                             const Color& color ) {
+
+  // Columns span the polygon within the whole target, independent of the
+  // scissor, so binned tiles accumulate exactly the same rows as a
+  // serial pass. Rows are limited to the scissor.
+  int x0 = max(0.0, floor(minx * sample_rate));
+  int x1 = min((double) ss_target_w, ceil(maxx * sample_rate));
+  int y0 = max((double) scissor_y0, floor(miny * sample_rate));
+  int y1 = min((double) scissor_y1, ceil (maxy * sample_rate));
+  int sx0 = max(x0, scissor_x0) - x0, sx1 = min(x1, scissor_x1) - x0;
+  if ( sx0 >= sx1 || y0 >= y1 ) return;
+  int w = x1 - x0, h = y1 - y0;
+  if ( area_buffer.size() < (size_t) (w + 2) * h ) {
+    area_buffer.resize((size_t) (w + 2) * h);
+  }
+  float* area = &area_buffer[0];
+  area_spans.assign(2 * h, w + 2);
+  for (int y = 0; y < h; y++) area_spans[2 * y + 1] = -1;
+  int* span = &area_spans[0];
+
+  for (size_t i = 0; i < count; i++) {
+    const Vector2D& a = points[i];
+    const Vector2D& b = points[(i + 1) % count];
+    accumulate_clipped(area, span, w, y0, y1,
+                       a.x * sample_rate - x0, a.y * sample_rate,
+                       b.x * sample_rate - x0, b.y * sample_rate);
+  }
+
+  // Sum the touched part of each row into the winding number, which is
+  // zero before it and (for a closed outline) after it. Runs of fully covered
+  // cells are blended as spans, partially covered cells scale the alpha
+  // by their coverage. The accumulator is cleared for the next polygon.
+  const RasterKernels& kernels = raster_kernels();
+  for (int y = 0; y < h; y++) {
+    float* row = area + y * (w + 2);
+    int lo = span[2 * y], hi = span[2 * y + 1];
+    if ( lo > hi ) continue;
+
+    float acc = 0;
+    int run = -1, end = min(hi, w);
+    for (int x = lo; x <= end; x++) {
+      float cover = 0;
+      if (x < w) {
+        acc += row[x];
+        cover = fabs(acc);
+        if (rule == EVENODD) {
+          cover = fmod(cover, 2.0f);
+          if (cover > 1) cover = 2 - cover;
+        }
+        cover = min(cover, 1.0f);
+      }
+      if (x < sx0) continue;
+
+      bool full = cover > 0.9999f && x < sx1;
+      if (full && run < 0) run = x;
+      if (!full && run >= 0) {
+        kernels.blend_span[sample_format](sample_ptr(x0 + run, y0 + y),
+                                          x - run, c);
+        run = -1;
+      }
+      if (!full && cover > 0.0001f && x < sx1) {
+        Color partial = color;
+        partial.a *= cover;
+        SampleColor pc = quantize(partial, sample_format);
+        if (!pc.transparent()) {
+          blend_sample(sample_ptr(x0 + x, y0 + y), pc, sample_format);
+        }
+      }
+    }
+    if (run >= 0) {
+      kernels.blend_span[sample_format](sample_ptr(x0 + run, y0 + y),
+                                        end + 1 - run, c);
+    }
+    fill(row + lo, row + hi + 1, 0.0f);
+  }
+}
+
+void SoftwareRendererImp::fill_polygon_scanline( const Vector2D* points,
+                                                 size_t count, FillRule rule,
+                                                 const SampleColor& c,
+                                                 const Color& color ) {
+
+  // Edge table in sample space, sample (x, y) sits at the integer point.
+  // An edge crosses the sample rows y with top <= y < bottom, so rows
+  // through a shared vertex count it once.
+  scan_edges.clear();
+  int first_row = scissor_y1, last_row = scissor_y0 - 1;
+  for (size_t i = 0; i < count; i++) {
+    const Vector2D& a = points[i];
+    const Vector2D& b = points[(i + 1) % count];
+    double ax = a.x * sample_rate - 0.5, ay = a.y * sample_rate - 0.5;
+    double bx = b.x * sample_rate - 0.5, by = b.y * sample_rate - 0.5;
+    if (ay == by) continue;
+
+    ScanEdge e;
+    e.winding = ay < by ? 1 : -1;
+    if (ay > by) { swap(ax, bx); swap(ay, by); }
+    e.x = ax; e.y = ay;
+    e.dxdy = (bx - ax) / (by - ay);
+    e.first = (int) max(ceil(ay), (double) scissor_y0);
+    e.last  = (int) min(ceil(by) - 1, (double) scissor_y1 - 1);
+    if (e.first > e.last) continue;
+    first_row = min(first_row, e.first);
+    last_row  = max(last_row, e.last);
+    scan_edges.push_back(e);
+  }
+  if (first_row > last_row) return;
+
+  // edges enter the active list in row order
+  vector<ScanEdge*> pending(scan_edges.size());
+  for (size_t i = 0; i < scan_edges.size(); i++) pending[i] = &scan_edges[i];
+  sort(pending.begin(), pending.end(), ScanEdge::starts_before);
+
+  // MSAA storage gathers a coverage mask per pixel over each pixel row
+  int sr = sample_rate;
+  int px0 = scissor_x0 / sr, pixel_row = first_row / sr;
+  if (msaa) scan_masks.assign((scissor_x1 - 1) / sr - px0 + 1, 0);
+
+  const RasterKernels& kernels = raster_kernels();
+  vector<ScanEdge*> active;
+  vector<pair<double, int> > crossings;
+  size_t next = 0;
+  for (int y = first_row; y <= last_row; y++) {
+
+    // update the active edges and find where they cross this row
+    while (next < pending.size() && pending[next]->first <= y) {
+      active.push_back(pending[next++]);
+    }
+    crossings.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < active.size(); i++) {
+      ScanEdge* e = active[i];
+      if (e->last < y) continue;
+      active[kept++] = e;
+      crossings.push_back(make_pair(e->x + (y - e->y) * e->dxdy, e->winding));
+    }
+    active.resize(kept);
+    sort(crossings.begin(), crossings.end());
+
+    if (msaa && y / sr != pixel_row) {
+      flush_coverage(px0, pixel_row, &scan_masks[0], scan_masks.size(), c, color);
+      pixel_row = y / sr;
+    }
+
+    // Walk the crossings left to right. Samples x with left <= x < right
+    // of every inside interval are covered.
+    int winding = 0;
+    for (size_t i = 0; i + 1 < crossings.size(); i++) {
+      winding += crossings[i].second;
+      bool inside = rule == EVENODD ? (winding & 1) : winding != 0;
+      if (!inside) continue;
+
+      double left  = max(crossings[i    ].first, (double) scissor_x0);
+      double right = min(crossings[i + 1].first, (double) scissor_x1);
+      int x0 = (int) ceil(left), x1 = (int) ceil(right) - 1;
+      if (x0 > x1) continue;
+
+      if (!msaa) {
+        kernels.blend_span[sample_format](sample_ptr(x0, y), x1 - x0 + 1, c);
+        continue;
+      }
+      uint64_t row_bits = (uint64_t) (y % sr) * sr;
+      for (int x = x0; x <= x1; x++) {
+        scan_masks[x / sr - px0] |= 1ull << (row_bits + x % sr);
+      }
+    }
+  }
+  if (msaa) {
+    flush_coverage(px0, pixel_row, &scan_masks[0], scan_masks.size(), c, color);
+  }
+}
+
+void SoftwareRendererImp::flush_coverage( int px0, int py, uint64_t* masks,
+                                          int n, const SampleColor& c,
+                                          const Color& color ) {
+  for (int i = 0; i < n; i++) {
+    if (!masks[i]) continue;
+    coverage_buffer->blend(px0 + i, py, masks[i], c, color);
+    masks[i] = 0;
+  }
 }
 
 void SoftwareRendererImp::rasterize_image( float x0, float y0,
                                            float x1, float y1,
                                            Texture& tex ) {
+  if ( binning ) {
+    BinnedPrimitive p( BinnedPrimitive::IMAGE, x0, y0, x1, y1 );
+    p.tex = &tex;
+    bin_primitive( p, floor(min(x0, x1)), floor(min(y0, y1)),
+                      floor(max(x0, x1)), floor(max(y0, y1)) );
+    return;
+  }
+
   // Task 6: 
   // Implement image rasterization
   float minX = floor(x0);
@@ -463,10 +1259,17 @@ void SoftwareRendererImp::rasterize_image( float x0, float y0,
   float maxY = floor(y1);
   float spanX = 1 + maxX - minX;
   float spanY = 1 + maxY - minY;
-  for(float x = minX; x <= maxX; x++){
-    for (float y = minY; y <= maxY; y++){
-      float nx = (x - minX) / spanX;
-      float ny = (y - minY) / spanY;
+
+  // only the pixels of the quad within the scissor are visited, zoomed
+  // in images are mostly off screen
+  int px0 = (int) max((double) minX, floor((double) scissor_x0 / sample_rate));
+  int py0 = (int) max((double) minY, floor((double) scissor_y0 / sample_rate));
+  int px1 = (int) min((double) maxX, ceil((double) scissor_x1 / sample_rate) - 1);
+  int py1 = (int) min((double) maxY, ceil((double) scissor_y1 / sample_rate) - 1);
+  for(int y = py0; y <= py1; y++){
+    for (int x = px0; x <= px1; x++){
+      float nx = (x - (double) minX) / spanX;
+      float ny = (y - (double) minY) / spanY;
       rasterize_point(x, y, sampler->sample_bilinear(tex, nx, ny, 0));
     }
   }
@@ -479,38 +1282,145 @@ void SoftwareRendererImp::resolve( void ) {
   // Task 4: 
   // Implement supersampling
   // You may also need to modify other functions marked with "Task 4".
-  int sampleCount = sample_rate * sample_rate;
-  for (int y = 0; y < target_h; y++){
-    for (int x = 0; x < target_w; x++){
-      uint sumR = 0;
-      uint sumG = 0;
-      uint sumB = 0;
-      uint sumA = 0;
-      for (int sy = 0; sy < sample_rate; sy++){
-         for (int sx = 0; sx < sample_rate; sx++){
-           int sampleIdx = (x * sample_rate + sx) + (y * sample_rate + sy)* ss_target_w;
-           sumR += super_sample_buffer[4 * sampleIdx + 0];
-           sumG += super_sample_buffer[4 * sampleIdx + 1];
-           sumB += super_sample_buffer[4 * sampleIdx + 2];
-           sumA += super_sample_buffer[4 * sampleIdx + 3];
-         }
-       }
-      Color finalColor = Color(
-        (float)(sumR / sampleCount) / 255.,
-        (float)(sumG / sampleCount) / 255.,
-        (float)(sumB / sampleCount) / 255.,
-        (float)(sumA / sampleCount) / 255.
-       );
-      render_target[4 * (x + y * target_w)] = sumR / sampleCount;
-      render_target[4 * (x + y * target_w) + 1] = sumG / sampleCount;
-      render_target[4 * (x + y * target_w) + 2] = sumB / sampleCount;
-      render_target[4 * (x + y * target_w) + 3] = sumA / sampleCount;
+  resolve_region( 0, 0, target_w, target_h );
+
+}
+
+void SoftwareRendererImp::resolve_region( int x0, int y0, int x1, int y1 ) {
+
+  if ( msaa ) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        coverage_buffer->resolve(x, y, &render_target[4 * (x + y * target_w)]);
+      }
+    }
+    coverage_buffer->clear(x0, y0, x1, y1);
+    return;
+  }
+
+  uint sampleCount = sample_rate * sample_rate;
+  bool wide = sample_format == SAMPLE_RGBA16;
+  for (int y = y0; y < y1; y++){
+    for (int x = x0; x < x1; x++){
+      uint sum[4] = { 0, 0, 0, 0 };
+      for (int sy = 0; sy < (int) sample_rate; sy++){
+        const unsigned char* row = sample_ptr(x * sample_rate, y * sample_rate + sy);
+        for (int sx = 0; sx < (int) sample_rate; sx++){
+          for (int i = 0; i < 4; i++) {
+            sum[i] += wide ? ((const uint16_t*) row)[4 * sx + i] : row[4 * sx + i];
+          }
+        }
+      }
+
+      unsigned char* pixel = &render_target[4 * (x + y * target_w)];
+      for (int i = 0; i < 4; i++) {
+        pixel[i] = resolve_channel(sum[i], sampleCount, sample_format);
+      }
+    }
+  }
+
+  // reset the resolved samples to white
+  for (int sy = y0 * sample_rate; sy < y1 * (int) sample_rate; sy++) {
+    memset(sample_ptr(x0 * sample_rate, sy), 255,
+           sample_size(sample_format) * (x1 - x0) * sample_rate);
+  }
+
+}
+
+// Tile Binning //
+
+void SoftwareRendererImp::bin_primitive( const BinnedPrimitive& p,
+                                         float minx, float miny,
+                                         float maxx, float maxy ) {
+
+  // reject empty (or NaN) bounds and primitives outside the region
+  // being drawn, whose pixels are those of the scissor
+  float x0 = scissor_x0 / sample_rate, x1 = scissor_x1 / sample_rate;
+  float y0 = scissor_y0 / sample_rate, y1 = scissor_y1 / sample_rate;
+  if ( !(minx <= maxx && miny <= maxy) ) return;
+  if ( maxx < x0 || minx >= x1 ) return;
+  if ( maxy < y0 || miny >= y1 ) return;
+
+  // range of overlapped tiles
+  int tx0 = (int) max(minx, x0) / kTileSize;
+  int ty0 = (int) max(miny, y0) / kTileSize;
+  int tx1 = (int) min(maxx, x1 - 1) / kTileSize;
+  int ty1 = (int) min(maxy, y1 - 1) / kTileSize;
+
+  size_t index = primitives.size();
+  primitives.push_back(p);
+  for ( int ty = ty0; ty <= ty1; ++ty ) {
+    for ( int tx = tx0; tx <= tx1; ++tx ) {
+      tile_bins[tx + ty * tiles_x].push_back(index);
     }
   }
-  clear_samples();
-  return;
+}
 
+void SoftwareRendererImp::rasterize_primitive( const BinnedPrimitive& p,
+                                               const Vector2D* points ) {
+
+  switch ( p.kind ) {
+    case BinnedPrimitive::POINT:
+      rasterize_point( p.x0, p.y0, p.color );
+      break;
+    case BinnedPrimitive::LINE:
+      rasterize_line( p.x0, p.y0, p.x1, p.y1, p.color );
+      break;
+    case BinnedPrimitive::TRIANGLE:
+      rasterize_triangle( p.x0, p.y0, p.x1, p.y1, p.x2, p.y2, p.color );
+      break;
+    case BinnedPrimitive::IMAGE:
+      rasterize_image( p.x0, p.y0, p.x1, p.y1, *p.tex );
+      break;
+    case BinnedPrimitive::POLYGON:
+      rasterize_polygon( points + p.first, p.count, p.rule, p.color );
+      break;
+  }
 }
 
+void SoftwareRendererImp::draw_bins( void ) {
+
+  int num_tiles = tiles_x * tiles_y;
+
+  // pixels of the region being drawn
+  int rx0 = scissor_x0 / sample_rate, rx1 = scissor_x1 / sample_rate;
+  int ry0 = scissor_y0 / sample_rate, ry1 = scissor_y1 / sample_rate;
+
+  // tiles cover disjoint parts of the sample buffer and the render
+  // target, so they can be rasterized and resolved independently
+  #pragma omp parallel for schedule(dynamic)
+  for ( int t = 0; t < num_tiles; ++t ) {
+
+    // the part of the tile within the region
+    int tx = t % tiles_x, ty = t / tiles_x;
+    int x0 = max(tx * kTileSize, rx0), x1 = min((tx + 1) * kTileSize, rx1);
+    int y0 = max(ty * kTileSize, ry0), y1 = min((ty + 1) * kTileSize, ry1);
+    if ( x0 >= x1 || y0 >= y1 ) continue;
+
+    // the samples of tiles skipped as a whole stay clear
+    if ( cancelled() ) continue;
+
+    // each tile gets a worker sharing the target but with its own scissor
+    SoftwareRendererImp worker;
+    static_cast<SoftwareRenderer&>(worker) = *this;
+    worker.scissor_x0 = x0 * sample_rate; worker.scissor_x1 = x1 * sample_rate;
+    worker.scissor_y0 = y0 * sample_rate; worker.scissor_y1 = y1 * sample_rate;
+    worker.super_sample_buffer = super_sample_buffer;
+    worker.coverage_buffer = coverage_buffer;
+    worker.ss_target_w = ss_target_w; worker.ss_target_h = ss_target_h;
+    worker.sample_format = sample_format;
+    worker.msaa = msaa;
+    worker.analytic = analytic;
+    worker.scanline = scanline;
+
+    // replay in painter's order
+    const vector<size_t>& bin = tile_bins[t];
+    for ( size_t i = 0; i < bin.size(); ++i ) {
+      worker.rasterize_primitive( primitives[bin[i]], polygon_points.data() );
+    }
+
+    worker.resolve_region( x0, y0, x1, y1 );
+  }
+}
 
 } // namespace CMU462
@@ -4,10 +4,13 @@
 #include <stdio.h>
 #include <vector>
 #include <stack>
+#include <atomic>
 
 #include "CMU462.h"
 #include "texture.h"
 #include "svg_renderer.h"
+#include "raster_kernels.h"
+#include "coverage_buffer.h"
 
 namespace CMU462 { // CMU462
 
@@ -64,14 +67,41 @@ class SoftwareRenderer : public SVGRenderer {
 }; // class SoftwareRenderer
 
 
+// Tile size (in pixels) used by the binned rasterizer
+static const int kTileSize = 64;
+
 class SoftwareRendererImp : public SoftwareRenderer {
  public:
 
-  SoftwareRendererImp( ) : SoftwareRenderer( ) { }
+  SoftwareRendererImp( ) : SoftwareRenderer( ), 
+    binned (true), binning (false), sample_format (SAMPLE_RGBA8),
+    msaa (false), analytic (false), scanline (true), culling (true),
+    bvh (NULL), affine (true), cancel (NULL), refinement_pass (0),
+    super_sample_buffer (NULL), coverage_buffer (NULL),
+    ss_target_w (0), ss_target_h (0) { }
 
   // draw an svg input to render target
   void draw_svg( SVG& svg );
 
+  // Draw svg after its view moved by (dx, dy) whole pixels, with the
+  // previous frame still in the render target: the frame is shifted
+  // along and only the exposed strips are drawn, scissored to them.
+  void pan_svg( SVG& svg, int dx, int dy );
+
+  // Progressive refinement. restart_refinement takes the frame in the
+  // render target as the first pass, then every refine_svg draws svg
+  // once more with its samples jittered within the pixels and the target
+  // shows the average of all passes so far, summed in a float
+  // accumulation buffer. At one sample per pixel this converges to any
+  // number of samples per pixel without a supersample buffer.
+  void restart_refinement();
+  void refine_svg( SVG& svg );
+
+  // passes averaged in the render target, 0 before a restart
+  inline size_t refinement_passes() const {
+    return refinement_pass;
+  }
+
   // set sample rate
   void set_sample_rate( size_t sample_rate );
   
@@ -79,40 +109,125 @@ class SoftwareRendererImp : public SoftwareRenderer {
   void set_render_target( unsigned char* target_buffer,
                           size_t width, size_t height );
 
+  // Toggle tile-binned rasterization. In binned mode primitives are
+  // first sorted into screen tiles, then the tiles are rasterized and
+  // resolved in parallel. The output is identical to the serial path.
+  inline void set_binned( bool binned ) {
+    this->binned = binned;
+  }
+
+  inline bool is_binned() const {
+    return binned;
+  }
+
+  // Set the storage format of the sample buffer. RGBA16 doubles the
+  // buffer size but keeps many translucent layers from banding.
+  void set_sample_format( SampleFormat format );
+
+  inline SampleFormat get_sample_format() const {
+    return sample_format;
+  }
+
+  // Toggle compressed MSAA storage. Instead of a full sample buffer each
+  // pixel keeps a coverage mask and two colors, and only pixels with more
+  // fragments store every sample, which allows sample rates up to 8
+  // (64 samples per pixel) in bounded memory.
+  void set_msaa( bool msaa );
+
+  inline bool is_msaa() const {
+    return msaa;
+  }
+
+  // Toggle analytic anti-aliasing of polygon and rectangle fills. The
+  // exact area of each sample cell covered by the outline is accumulated
+  // (as in font rasterizers) and used to scale the fill alpha, so edges
+  // are smooth even at one sample per pixel. Not used with MSAA storage.
+  inline void set_analytic( bool analytic ) {
+    this->analytic = analytic;
+  }
+
+  inline bool is_analytic() const {
+    return analytic;
+  }
+
+  // Toggle the scanline polygon filler. When set, polygon outlines are
+  // filled directly with an active edge table, honoring their fill rule;
+  // otherwise they are triangulated, falling back to the scanline filler
+  // when triangulation fails (e.g. on self-intersecting outlines).
+  inline void set_scanline( bool scanline ) {
+    this->scanline = scanline;
+  }
+
+  inline bool is_scanline() const {
+    return scanline;
+  }
+
+  // Toggle view culling. When set, elements (and whole groups) whose
+  // bounds in the document's BVH lie outside the render target are not
+  // drawn.
+  inline void set_culling( bool culling ) {
+    this->culling = culling;
+  }
+
+  inline bool is_culling() const {
+    return culling;
+  }
+
+  // Give up drawing once *cancel is set. It is checked between elements
+  // and between tiles; a cancelled draw leaves the render target partly
+  // drawn (but the samples clear). NULL (the default) never cancels.
+  inline void set_cancel( const std::atomic<bool>* cancel ) {
+    this->cancel = cancel;
+  }
+
  private:
 
   // Primitive Drawing //
 
-  // Draws an SVG element
-  void draw_element( SVGElement* element );
+  // draw svg into the pixels [x0,x1)x[y0,y1) only, leaving the rest of
+  // the render target as it is
+  void draw_region( SVG& svg, int x0, int y0, int x1, int y1 );
+
+  // Draw the children [first,first+count) in list.children of group (the
+  // document if NULL) that overlap the scissor. transform is the
+  // index of the group's transform.
+  void draw_children( const DisplayList& list, const Group* group,
+                      size_t first, size_t count, uint32_t transform );
+
+  // Draws a display list command
+  void draw_command( const DisplayList& list, uint32_t index );
 
   void clear_samples();
 
+  // (re)allocate the sample buffer for the current target and format
+  void alloc_samples();
+
+  // address of sample (x,y)
+  inline unsigned char* sample_ptr( int x, int y );
+
   void rasterize_sample(float x, float y, Color col);
 
   // Draws a point
-  void draw_point( Point& p );
+  void draw_point( const DisplayCommand& cmd, const Vector2D* points );
 
   // Draw a line
-  void draw_line( Line& line );
+  void draw_line( const DisplayCommand& cmd, const Vector2D* points );
 
   // Draw a polyline
-  void draw_polyline( Polyline& polyline );
+  void draw_polyline( const DisplayCommand& cmd, const Vector2D* points );
 
   // Draw a rectangle
-  void draw_rect ( Rect& rect );
+  void draw_rect ( const DisplayCommand& cmd, const Vector2D* points );
 
   // Draw a polygon
-  void draw_polygon( Polygon& polygon );
+  void draw_polygon( const DisplayCommand& cmd, const Vector2D* points,
+                     const uint32_t* triangles );
 
   // Draw a ellipse
-  void draw_ellipse( Ellipse& ellipse );
+  void draw_ellipse( const DisplayCommand& cmd, const Vector2D* points );
 
   // Draws a bitmap image
-  void draw_image( Image& image );
-
-  // Draw a group
-  void draw_group( Group& group );
+  void draw_image( const DisplayCommand& cmd, const Vector2D* points );
 
   // Rasterization //
 
@@ -130,14 +245,184 @@ class SoftwareRendererImp : public SoftwareRenderer {
                            float x2, float y2,
                            Color color );
 
+  // rasterize a closed polygon outline (screen space)
+  void rasterize_polygon( const Vector2D* points, size_t count,
+                          FillRule rule, Color color );
+
+  // fill a polygon with analytic coverage of the samples cells
+  void fill_polygon_area( const Vector2D* points, size_t count,
+                          FillRule rule, double minx, double miny,
+                          double maxx, double maxy,
+                          const SampleColor& c, const Color& color );
+
+  // fill a polygon by scanning sample rows with an active edge table
+  void fill_polygon_scanline( const Vector2D* points, size_t count,
+                              FillRule rule, const SampleColor& c,
+                              const Color& color );
+
+  // blend the per-pixel coverage masks of pixels [px0,px0+n) of pixel
+  // row py into the MSAA storage and clear them
+  void flush_coverage( int px0, int py, uint64_t* masks, int n,
+                       const SampleColor& c, const Color& color );
+
   // rasterize an image
   void rasterize_image( float x0, float y0,
                         float x1, float y1,
                         Texture& tex );
 
+  // fill a triangle given in sample space (inside the guard band)
+  void fill_triangle( float x0, float y0,
+                      float x1, float y1,
+                      float x2, float y2,
+                      Color color );
+
+  // fill the samples [minX,maxX]x[minY,maxY] inside the edge functions
+  // set up by fill_triangle, one coverage mask per pixel (MSAA storage)
+  void fill_coverage( int minX, int minY, int maxX, int maxY,
+                      const int64_t* stepX, const int64_t* stepY,
+                      const int64_t* rowE,
+                      const SampleColor& c, const Color& color );
+
+  // clip a sample space polygon to the guard band
+  void clip_to_guard_band( std::vector<Vector2D>& poly );
+
   // resolve samples to render target
   void resolve( void );
 
+  // resolve the samples of pixels [x0,x1)x[y0,y1) and clear them
+  void resolve_region( int x0, int y0, int x1, int y1 );
+
+  // Tile Binning //
+
+  // a screen space primitive recorded by the binning front-end
+  struct BinnedPrimitive {
+    enum Kind { POINT, LINE, TRIANGLE, IMAGE, POLYGON };
+
+    BinnedPrimitive( Kind kind, float x0 = 0, float y0 = 0,
+                     float x1 = 0, float y1 = 0, float x2 = 0, float y2 = 0 )
+      : kind (kind), x0 (x0), y0 (y0), x1 (x1), y1 (y1), x2 (x2), y2 (y2),
+        tex (NULL), first (0), count (0), rule (NONZERO) { }
+
+    Kind kind;
+    float x0, y0, x1, y1, x2, y2;
+    Color color;
+    Texture* tex;
+    size_t first, count;  // range of polygon_points
+    FillRule rule;
+  };
+
+  // record a primitive in the bins of all tiles overlapped by its
+  // conservative pixel bounds [minx,maxx]x[miny,maxy]
+  void bin_primitive( const BinnedPrimitive& p,
+                      float minx, float miny,
+                      float maxx, float maxy );
+
+  // rasterize a recorded primitive, polygons index into points
+  void rasterize_primitive( const BinnedPrimitive& p, const Vector2D* points );
+
+  // rasterize and resolve all tiles in parallel
+  void draw_bins( void );
+
+  // binned mode selected
+  bool binned;
+
+  // front-end is recording primitives instead of rasterizing them
+  bool binning;
+
+  // recorded primitives (in painter's order) and per-tile indices
+  size_t tiles_x, tiles_y;
+  std::vector<BinnedPrimitive> primitives;
+  std::vector<std::vector<size_t> > tile_bins;
+  std::vector<Vector2D> polygon_points;
+
+  // samples outside [x0,x1)x[y0,y1) (in sample space) are not written
+  int scissor_x0, scissor_y0, scissor_x1, scissor_y1;
+
+  // storage format of the sample buffer
+  SampleFormat sample_format;
+
+  // samples are stored in the coverage buffer
+  bool msaa;
+
+  // polygons are filled with analytic coverage
+  bool analytic;
+
+  // polygons are filled by the scanline filler
+  bool scanline;
+
+  // elements outside the view are culled, using the bvh of the svg
+  // being drawn (NULL when not culling)
+  bool culling;
+  const SVGBVH* bvh;
+
+  // Transformation from object to screen space of the command being
+  // drawn, composed from the svg to screen transformation and the
+  // command's cached transform. While svg_2_screen is affine (it always
+  // is for the viewport) points are mapped with screen, otherwise with
+  // the full projective transformation.
+  struct ScreenTransform {
+    double a, b, c, d, e, f;
+    inline Vector2D apply( const Vector2D& p ) const {
+      return Vector2D( a * p.x + c * p.y + e, b * p.x + d * p.y + f );
+    }
+  };
+  bool affine;
+  ScreenTransform root, screen;
+
+  // make m (from object to svg space) the current transformation
+  void set_transform( const Affine2D& m );
+
+  // map a point of the current command to screen space
+  inline Vector2D to_screen( const Vector2D& p ) {
+    return affine ? screen.apply( p ) : transform( p );
+  }
+
+  // map n points of the current command to screen space at once, into out
+  void to_screen( const Vector2D* points, size_t n, std::vector<Vector2D>& out );
+
+  // screen space vertices of the polyline or polygon being drawn, shared
+  // by its fill and stroke
+  std::vector<Vector2D> screen_points;
+
+  // signed area accumulation rows of rasterize_polygon and the range of
+  // cells touched in each row
+  std::vector<float> area_buffer;
+  std::vector<int> area_spans;
+
+  // edge table and per-pixel masks of fill_polygon_scanline
+  struct ScanEdge {
+    double x, y, dxdy;   // upper end point and slope, in sample space
+    int first, last;     // sample rows crossed
+    int winding;         // +1 downwards, -1 upwards
+
+    static bool starts_before( const ScanEdge* a, const ScanEdge* b ) {
+      return a->first < b->first;
+    }
+  };
+  std::vector<ScanEdge> scan_edges;
+  std::vector<uint64_t> scan_masks;
+
+  // flag of set_cancel, or NULL
+  const std::atomic<bool>* cancel;
+  inline bool cancelled() const {
+    return cancel && cancel->load( std::memory_order_relaxed );
+  }
+
+  // sum of the passes of progressive refinement, 4 channels per pixel
+  std::vector<float> accumulation;
+  size_t refinement_pass;
+
+  // sample buffer (or MSAA storage) of this renderer
+  std::vector<unsigned char> sample_storage;
+  CoverageBuffer coverage_storage;
+
+  // Samples being drawn to, ss_target_w x ss_target_h of them. These are
+  // the storage of the renderer itself, except for binned tile workers
+  // which share the storage of the renderer that created them.
+  unsigned char* super_sample_buffer;
+  CoverageBuffer* coverage_buffer;
+  int ss_target_w, ss_target_h;
+
 }; // class SoftwareRendererImp
 
 
@@ -1,8 +1,9 @@
 #include "svg.h"
 #include "png.h"
-#include "base64.h"
+#include "image_loader.h"
 
 #include <string>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -24,8 +25,73 @@ SVG::~SVG() {
   } elements.clear();
 }
 
+void SVG::update() {
+  bvh.build( *this );
+  display_list.compile( *this );
+}
+
+void SVG::geometry_changed( const SVGElement* element ) {
+  bvh.build( *this );
+  if ( !display_list.update_geometry( element ) ) {
+    display_list.compile( *this );
+  }
+}
+
 // Parser //
 
+// values of base64 characters, the others skip whitespace or end the data
+static const signed char kBase64Skip = -1;
+static const signed char kBase64End = -2;
+
+struct Base64Table {
+
+  Base64Table( ) {
+    const char* chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                        "abcdefghijklmnopqrstuvwxyz"
+                        "0123456789+/";
+    memset( value, kBase64End, sizeof(value) );
+    value[' '] = value['\t'] = value['\n'] = value['\r'] = kBase64Skip;
+    for ( int i = 0; i < 64; ++i ) value[(unsigned char) chars[i]] = i;
+  }
+
+  signed char value[256];
+};
+
+static const Base64Table kBase64;
+
+// Decode base64 text to out in a single pass, skipping whitespace. The
+// data ends at the padding, or at any other character.
+static void decode_base64( const char* text, vector<unsigned char>& out ) {
+
+  out.resize( strlen( text ) / 4 * 3 + 3 );
+  unsigned char* o = &out[0];
+  const unsigned char* p = (const unsigned char*) text;
+
+  unsigned int bits = 0;
+  int n = 0;
+  for ( ; ; ++p ) {
+    int v = kBase64.value[*p];
+    if ( v < 0 ) {
+      if ( v == kBase64Skip ) continue;
+      break;
+    }
+    bits = bits << 6 | v;
+    if ( ++n == 4 ) {
+      o[0] = bits >> 16; o[1] = bits >> 8; o[2] = bits;
+      o += 3;
+      n = 0;
+    }
+  }
+
+  // a last group of 2 or 3 characters holds 1 or 2 bytes
+  if ( n == 2 ) {
+    *o++ = bits >> 4;
+  } else if ( n == 3 ) {
+    *o++ = bits >> 10; *o++ = bits >> 2;
+  }
+  out.resize( o - &out[0] );
+}
+
 int SVGParser::load( const char* filename, SVG* svg ) {
 
   ifstream in( filename );
@@ -51,6 +117,7 @@ int SVGParser::load( const char* filename, SVG* svg ) {
   root->QueryFloatAttribute( "height", &svg->height );
 
   parseSVG( root, svg );
+  svg->update();
 
   return 0;
 }
@@ -328,6 +395,11 @@ void SVGParser::parsePolygon( XMLElement* xml, Polygon* polygon ) {
   while( points >> x >> c >> y ) {
      polygon->points.push_back( Vector2D( x, y ) );
   }
+
+  const char* fill_rule = xml->Attribute( "fill-rule" );
+  if ( fill_rule && string(fill_rule) == "evenodd" ) {
+    polygon->fillRule = EVENODD;
+  }
 }
 
 void SVGParser::parseEllipse( XMLElement* xml, Ellipse* ellipse ) {
@@ -344,34 +416,13 @@ void SVGParser::parseImage( XMLElement* xml, Image* image ) {
   image->dimension = Vector2D ( xml->FloatAttribute( "width"  ),
                                 xml->FloatAttribute( "height" )); 
 
-  // read png data
+  // the png file, base64 encoded after the comma of the data url, is
+  // decoded from the attribute itself and kept until the image is in view
+  image->png.clear();
   const char* data = xml->Attribute( "xlink:href" );
-  while (*data != ',') data++; data++;
-  
-  // decode base64 encoded data
-  string encoded = data;
-  encoded.erase(remove(encoded.begin(), encoded.end(), ' ' ), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\t'), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
-  string decoded = base64_decode(encoded);
-
-  // load decoded data into buffer
-  const unsigned char* buffer = (unsigned char*) decoded.c_str(); 
-  size_t size = decoded.size();
-
-  // load into png
-  PNG png; PNGParser::load(buffer, size, png);
-  
-  // create bitmap texture from png (mip level 0)
-  MipLevel mip_start;
-  mip_start.width  = png.width;
-  mip_start.height = png.height;
-  mip_start.texels = png.pixels;
-
-  // add to svg
-  image->tex.width  = mip_start.width;
-  image->tex.height = mip_start.height;
-  image->tex.mipmap.push_back(mip_start);
+  if ( data ) data = strchr( data, ',' );
+  if ( data ) decode_base64( data + 1, image->png );
+  ImageLoader::placeholder( image->tex );
 }
 
 void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
@@ -6,6 +6,8 @@
 
 #include "color.h"
 #include "texture.h"
+#include "svg_bvh.h"
+#include "display_list.h"
 #include "vector2D.h"
 #include "matrix3x3.h"
 
@@ -26,6 +28,12 @@ typedef enum e_SVGElementType {
   GROUP
 } SVGElementType;
 
+// Rule deciding which regions of a self-overlapping outline are filled
+typedef enum e_FillRule {
+  NONZERO = 0,
+  EVENODD
+} FillRule;
+
 struct Style {
   Color strokeColor;
   Color fillColor;
@@ -92,8 +100,9 @@ struct Rect : SVGElement {
 
 struct Polygon : SVGElement {
 
-  Polygon() : SVGElement  ( POLYGON ) { }
+  Polygon() : SVGElement  ( POLYGON ), fillRule ( NONZERO ) { }
   std::vector<Vector2D> points;
+  FillRule fillRule;
 
 };
 
@@ -111,7 +120,11 @@ struct Image : SVGElement {
   Vector2D position;
   Vector2D dimension;
   Texture tex;
-  
+
+  // the png file of the image, tex is a placeholder until it is decoded
+  // (see ImageLoader)
+  std::vector<unsigned char> png;
+
 };
 
 struct SVG {
@@ -120,6 +133,21 @@ struct SVG {
   float width, height;
   std::vector<SVGElement*> elements;
 
+  // element bounds for view culling
+  SVGBVH bvh;
+
+  // elements flattened for drawing
+  DisplayList display_list;
+
+  // Rebuild bvh and display list from the elements. SVGParser::load
+  // does so, it must be called again after changing the document.
+  void update();
+
+  // Update bvh and display list after the points of element (not a
+  // group) were edited, cheaper than update when their number is the
+  // same.
+  void geometry_changed( const SVGElement* element );
+
 };
 
 class SVGParser {
@@ -0,0 +1,235 @@
+#include "svg_bvh.h"
+
+#include "svg.h"
+#include "vector3D.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+// Most elements stored in a leaf
+static const size_t kLeafSize = 4;
+
+// orders elements by the centroid of their bounds along one axis
+struct CentroidLess {
+  const vector<BBox2D>& boxes;
+  int axis;
+  CentroidLess( const vector<BBox2D>& boxes, int axis )
+    : boxes ( boxes ), axis ( axis ) { }
+  bool operator()( size_t a, size_t b ) const {
+    Vector2D ca = boxes[a].centroid(), cb = boxes[b].centroid();
+    return axis ? ca.y < cb.y : ca.x < cb.x;
+  }
+};
+
+BBox2D BBox2D::transformed( const Matrix3x3& m ) const {
+
+  if ( empty() ) return *this;
+
+  BBox2D box;
+  for (int i = 0; i < 4; i++) {
+    Vector3D p = m * Vector3D( i & 1 ? max.x : min.x,
+                               i & 2 ? max.y : min.y, 1 );
+    double x = p.x / p.z, y = p.y / p.z;
+
+    // corners behind the projection or off to infinity leave the box
+    // unbounded, so that it is never culled
+    if ( !(p.z > 0 && isfinite(x) && isfinite(y)) ) {
+      double huge = numeric_limits<double>::max();
+      box.min = Vector2D( -huge, -huge );
+      box.max = Vector2D(  huge,  huge );
+      return box;
+    }
+    box.expand( Vector2D( x, y ) );
+  }
+  return box;
+}
+
+void SVGBVH::build( const SVG& svg ) {
+
+  clear();
+
+  vector<BBox2D> boxes( svg.elements.size() );
+  for (size_t i = 0; i < boxes.size(); i++) {
+    boxes[i] = build_element( svg.elements[i] );
+  }
+  build_tree( root, boxes );
+  built = true;
+}
+
+void SVGBVH::clear() {
+
+  root = Tree();
+  groups.clear();
+  built = false;
+}
+
+BBox2D SVGBVH::build_element( const SVGElement* element ) {
+
+  BBox2D box;
+  switch ( element->type ) {
+    case POINT:
+      box.expand( static_cast<const Point*>(element)->position );
+      break;
+    case LINE: {
+      const Line* line = static_cast<const Line*>(element);
+      box.expand( line->from );
+      box.expand( line->to );
+      break;
+    }
+    case POLYLINE: {
+      const Polyline* polyline = static_cast<const Polyline*>(element);
+      for (size_t i = 0; i < polyline->points.size(); i++) {
+        box.expand( polyline->points[i] );
+      }
+      break;
+    }
+    case RECT: {
+      const Rect* rect = static_cast<const Rect*>(element);
+      box.expand( rect->position );
+      box.expand( rect->position + rect->dimension );
+      break;
+    }
+    case POLYGON: {
+      const Polygon* polygon = static_cast<const Polygon*>(element);
+      for (size_t i = 0; i < polygon->points.size(); i++) {
+        box.expand( polygon->points[i] );
+      }
+      break;
+    }
+    case ELLIPSE: {
+      const Ellipse* ellipse = static_cast<const Ellipse*>(element);
+      box.expand( ellipse->center - ellipse->radius );
+      box.expand( ellipse->center + ellipse->radius );
+      break;
+    }
+    case IMAGE: {
+      const Image* image = static_cast<const Image*>(element);
+      box.expand( image->position );
+      box.expand( image->position + image->dimension );
+      break;
+    }
+    case GROUP: {
+      const Group* group = static_cast<const Group*>(element);
+      vector<BBox2D> boxes( group->elements.size() );
+      for (size_t i = 0; i < boxes.size(); i++) {
+        boxes[i] = build_element( group->elements[i] );
+        box.expand( boxes[i] );
+      }
+      build_tree( groups[group], boxes );
+      break;
+    }
+    default:
+      break;
+  }
+
+  return box.transformed( element->transform );
+}
+
+void SVGBVH::build_tree( Tree& tree, const vector<BBox2D>& boxes ) {
+
+  tree.nodes.clear();
+  tree.boxes = boxes;
+
+  // elements with empty bounds draw nothing and are left out
+  tree.order.clear();
+  for (size_t i = 0; i < boxes.size(); i++) {
+    if ( !boxes[i].empty() ) tree.order.push_back(i);
+  }
+  if ( tree.order.empty() ) return;
+
+  // split nodes at the median centroid along their longer side, the
+  // elements of every subtree stay contiguous in order
+  vector<size_t> stack;
+  Tree::Node root = { BBox2D(), 0, tree.order.size(), 0, 0 };
+  tree.nodes.push_back( root );
+  stack.push_back( 0 );
+  while ( !stack.empty() ) {
+
+    size_t index = stack.back();
+    stack.pop_back();
+    size_t first = tree.nodes[index].first;
+    size_t count = tree.nodes[index].count;
+
+    BBox2D box, centroids;
+    for (size_t i = first; i < first + count; i++) {
+      box.expand( boxes[tree.order[i]] );
+      centroids.expand( boxes[tree.order[i]].centroid() );
+    }
+    tree.nodes[index].box = box;
+
+    Vector2D extent = centroids.max - centroids.min;
+    if ( count <= kLeafSize || (extent.x == 0 && extent.y == 0) ) continue;
+
+    int axis = extent.x >= extent.y ? 0 : 1;
+    size_t mid = first + count / 2;
+    nth_element( tree.order.begin() + first, tree.order.begin() + mid,
+                 tree.order.begin() + first + count,
+                 CentroidLess( boxes, axis ) );
+
+    Tree::Node left  = { BBox2D(), first, mid - first, 0, 0 };
+    Tree::Node right = { BBox2D(), mid, first + count - mid, 0, 0 };
+    tree.nodes[index].left = tree.nodes.size();
+    tree.nodes.push_back( left );
+    tree.nodes[index].right = tree.nodes.size();
+    tree.nodes.push_back( right );
+    stack.push_back( tree.nodes[index].left );
+    stack.push_back( tree.nodes[index].right );
+  }
+}
+
+bool SVGBVH::query( const Group* group, const Matrix3x3& to_screen,
+                    const BBox2D& view, vector<size_t>& visible ) const {
+
+  visible.clear();
+  if ( !built ) return false;
+
+  const Tree* tree = &root;
+  if ( group ) {
+    map<const Group*, Tree>::const_iterator it = groups.find(group);
+    if ( it == groups.end() ) return false;
+    tree = &it->second;
+  }
+
+  if ( !tree->nodes.empty() ) {
+    query_node( *tree, 0, to_screen, view, visible );
+  }
+  sort( visible.begin(), visible.end() );
+  return true;
+}
+
+BBox2D SVGBVH::bounds() const {
+
+  return root.nodes.empty() ? BBox2D() : root.nodes[0].box;
+}
+
+void SVGBVH::query_node( const Tree& tree, size_t index,
+                         const Matrix3x3& to_screen, const BBox2D& view,
+                         vector<size_t>& visible ) {
+
+  const Tree::Node& node = tree.nodes[index];
+  BBox2D box = node.box.transformed( to_screen );
+  if ( !box.intersects( view ) ) return;
+
+  // everything below a node inside the view is visible
+  if ( view.contains( box ) ) {
+    visible.insert( visible.end(), tree.order.begin() + node.first,
+                    tree.order.begin() + node.first + node.count );
+    return;
+  }
+
+  if ( node.left ) {
+    query_node( tree, node.left, to_screen, view, visible );
+    query_node( tree, node.right, to_screen, view, visible );
+    return;
+  }
+
+  for (size_t i = node.first; i < node.first + node.count; i++) {
+    size_t element = tree.order[i];
+    if ( tree.boxes[element].transformed( to_screen ).intersects( view ) ) {
+      visible.push_back( element );
+    }
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,126 @@
+#ifndef CMU462_SVG_BVH_H
+#define CMU462_SVG_BVH_H
+
+#include <map>
+#include <vector>
+
+#include "CMU462.h"
+#include "vector2D.h"
+#include "matrix3x3.h"
+
+namespace CMU462 {
+
+struct SVG;
+struct Group;
+struct SVGElement;
+
+/**
+ * Axis aligned bounding box. Boxes are empty until a point is added.
+ */
+struct BBox2D {
+
+  BBox2D( ) : min( INF_D, INF_D ), max( -INF_D, -INF_D ) { }
+
+  inline bool empty() const {
+    return !(min.x <= max.x && min.y <= max.y);
+  }
+
+  inline void expand( const Vector2D& p ) {
+    min.x = std::min(min.x, p.x); max.x = std::max(max.x, p.x);
+    min.y = std::min(min.y, p.y); max.y = std::max(max.y, p.y);
+  }
+
+  inline void expand( const BBox2D& b ) {
+    if ( b.empty() ) return;
+    expand( b.min ); expand( b.max );
+  }
+
+  inline bool intersects( const BBox2D& b ) const {
+    return min.x <= b.max.x && b.min.x <= max.x &&
+           min.y <= b.max.y && b.min.y <= max.y;
+  }
+
+  inline bool contains( const BBox2D& b ) const {
+    return min.x <= b.min.x && b.max.x <= max.x &&
+           min.y <= b.min.y && b.max.y <= max.y;
+  }
+
+  inline Vector2D centroid() const {
+    return 0.5 * (min + max);
+  }
+
+  // bounds of the box corners mapped by m, which covers the mapped box
+  // when m is affine
+  BBox2D transformed( const Matrix3x3& m ) const;
+
+  Vector2D min, max;
+
+}; // struct BBox2D
+
+/**
+ * Bounding volume hierarchy over the elements of an SVG, used to cull
+ * elements outside the view. The document and every group get a tree over
+ * their direct children, bounded in the coordinate space they share: each
+ * bound has the element's own transform folded in, and a group's bound
+ * covers its whole subtree. Culling a group therefore skips everything
+ * below it.
+ */
+class SVGBVH {
+ public:
+
+  SVGBVH( ) : built ( false ) { }
+
+  // Build the trees of svg from its current elements, replacing any
+  // previous ones. Must be called again when the document changes.
+  void build( const SVG& svg );
+
+  // drop all trees, queries then report every element as visible
+  void clear();
+
+  // Find the children of group (the document elements if group is NULL)
+  // whose bounds, mapped by to_screen, overlap view. Their indices are
+  // written to visible in painter's (document) order. Returns false if
+  // there is no tree for group, in which case all children are visible.
+  bool query( const Group* group, const Matrix3x3& to_screen,
+              const BBox2D& view, std::vector<size_t>& visible ) const;
+
+  // bounds of all document elements in svg coordinates
+  BBox2D bounds() const;
+
+ private:
+
+  // Tree over a list of sibling elements, the root is node 0. Each node
+  // covers the count elements starting at first in order; left and right
+  // are the indices of the children of inner nodes and 0 for leaves.
+  // boxes holds the bounds of every element.
+  struct Tree {
+    struct Node {
+      BBox2D box;
+      size_t first, count;
+      size_t left, right;
+    };
+    std::vector<Node> nodes;
+    std::vector<size_t> order;
+    std::vector<BBox2D> boxes;
+  };
+
+  // bounds of element in the space of its parent, building the trees of
+  // the groups below it
+  BBox2D build_element( const SVGElement* element );
+
+  // build tree over elements with the given bounds
+  static void build_tree( Tree& tree, const std::vector<BBox2D>& boxes );
+
+  static void query_node( const Tree& tree, size_t node,
+                          const Matrix3x3& to_screen, const BBox2D& view,
+                          std::vector<size_t>& visible );
+
+  bool built;
+  Tree root;
+  std::map<const Group*, Tree> groups;
+
+}; // class SVGBVH
+
+} // namespace CMU462
+
+#endif // CMU462_SVG_BVH_H
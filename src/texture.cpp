@@ -25,6 +25,8 @@ inline void float_to_uint8( unsigned char* dst, float src[4] ) {
   dst_uint8[3] = (uint8_t) ( 255.f * max( 0.0f, min( 1.0f, src[3])));
 }
 
+Sampler2D::~Sampler2D() { }
+
 void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
 
   // NOTE: 
@@ -86,13 +88,13 @@ Color Sampler2DImp::sample_nearest(Texture& tex,
     return Color(1, 0, 1, 1);
   }
   // Task 6: Implement nearest neighbour interpolation
-  MipLevel mip = tex.mipmap[level];
+  const MipLevel& mip = tex.mipmap[level];
   int idx_w = (u * mip.width);
   int idx_h = (v * mip.height);
   return getColorAtTexel(mip, idx_w, idx_h);
 }
 
-Color Sampler2DImp::getColorAtTexel(MipLevel mip, int x, int y){
+Color Sampler2DImp::getColorAtTexel(const MipLevel& mip, int x, int y){
   int idx = 4 * (x + (y * mip.width));
   if(idx < 0 || idx >= mip.texels.size()){
     return Color(1, 0, 1, 1);
@@ -111,7 +113,7 @@ Color Sampler2DImp::sample_bilinear(Texture& tex,
     return Color(1, 0, 1, 1);
   }
   // Task 6: Implement bilinear filtering
-  MipLevel mip = tex.mipmap[level];
+  const MipLevel& mip = tex.mipmap[level];
   float idx_w = max(0.f, (u * mip.width - 0.5f));
   float idx_h = max(0.f, (v * mip.height - 0.5f));
   float x0 = floor(idx_w);
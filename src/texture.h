@@ -76,7 +76,7 @@ class Sampler2DImp : public Sampler2D {
                          float u, float v, 
                          float u_scale, float v_scale);
  private:
-  Color getColorAtTexel(MipLevel mip, int x, int y);
+  Color getColorAtTexel(const MipLevel& mip, int x, int y);
   
 }; // class sampler2DImp
 
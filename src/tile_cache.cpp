@@ -0,0 +1,417 @@
+#include "tile_cache.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+namespace CMU462 {
+
+// Views whose scale is off a zoom level by more than this (relative)
+// are not drawn from the cache
+static const double kLevelTolerance = 1e-4;
+
+// floor(a / b) for b > 0
+static inline int floor_div( int a, int b ) {
+  return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+TileCache::TileCache( size_t budget )
+  : budget (budget), msaa (false), analytic (false), scanline (true),
+    sample_format (SAMPLE_RGBA8), has_view (false), target (NULL),
+    target_w (0), target_h (0), move_x (0), move_y (0), busy (false),
+    cancel (false), stopping (false) {
+
+  renderer.set_binned( false );
+  renderer.set_cancel( &cancel );
+  thread = std::thread( &TileCache::run, this );
+}
+
+TileCache::~TileCache( ) {
+
+  {
+    lock_guard<std::mutex> lock( mutex );
+    stopping = true;
+    cancel = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void TileCache::set_budget( size_t budget ) {
+  this->budget = budget;
+  evict();
+}
+
+void TileCache::clear() {
+
+  tiles.clear();
+  index.clear();
+  pending.clear();
+
+  unique_lock<std::mutex> lock( mutex );
+  queue.clear();
+  if ( busy ) cancel = true;
+  done.wait( lock, [this] { return !busy; } );
+  rendered.clear();
+}
+
+void TileCache::drop( size_t tab, const BBox2D& bounds ) {
+
+  list<Tile>::iterator i = tiles.begin();
+  while ( i != tiles.end() ) {
+    if ( i->key.tab == tab &&
+         TileCache::bounds( i->key, i->key.x + 1 ).intersects( bounds ) ) {
+      index.erase( i->key );
+      i = tiles.erase( i );
+    } else {
+      ++i;
+    }
+  }
+
+  // Queued rows of tab are dropped (a view queues them again), so the
+  // thread draws nothing of tab once the row being rendered is done. It
+  // is cancelled if it overlaps bounds, it would be dropped anyway.
+  unique_lock<std::mutex> lock( mutex );
+  for ( size_t j = 0; j < queue.size(); ) {
+    if ( queue[j].key.tab == tab ) {
+      unpend( queue[j] );
+      queue.erase( queue.begin() + j );
+    } else {
+      ++j;
+    }
+  }
+  if ( busy && current.key.tab == tab &&
+       TileCache::bounds( current.key, current.x1 ).intersects( bounds ) ) {
+    cancel = true;
+  }
+  done.wait( lock, [this, tab] { return !busy || current.key.tab != tab; } );
+
+  for ( size_t j = 0; j < rendered.size(); ) {
+    const Row& row = rendered[j].row;
+    if ( row.key.tab == tab &&
+         TileCache::bounds( row.key, row.x1 ).intersects( bounds ) ) {
+      unpend( row );
+      rendered.erase( rendered.begin() + j );
+    } else {
+      ++j;
+    }
+  }
+}
+
+int TileCache::level( double scale ) {
+  return (int) floor( log2( scale ) * kZoomLevelSteps + 0.5 );
+}
+
+double TileCache::level_scale( int level ) {
+  return exp2( (double) level / kZoomLevelSteps );
+}
+
+const TileCache::Tile* TileCache::find( const Key& key ) {
+
+  unordered_map<Key, list<Tile>::iterator, KeyHash>::iterator i =
+    index.find( key );
+  if ( i == index.end() ) return NULL;
+
+  // move to the front of the LRU order
+  tiles.splice( tiles.begin(), tiles, i->second );
+  return &*i->second;
+}
+
+void TileCache::evict() {
+  while ( memory_usage() > budget && !tiles.empty() ) {
+    index.erase( tiles.back().key );
+    tiles.pop_back();
+  }
+}
+
+BBox2D TileCache::bounds( const Key& key, int x1 ) {
+
+  double size = kCacheTileSize / level_scale( key.level );
+  double pixel = size / kCacheTileSize;
+  BBox2D box;
+  box.expand( Vector2D( key.x * size - pixel, key.y * size - pixel ) );
+  box.expand( Vector2D( x1 * size + pixel, (key.y + 1) * size + pixel ) );
+  return box;
+}
+
+void TileCache::check_settings( const FrameSpec& spec ) {
+
+  if ( spec.msaa == msaa && spec.analytic == analytic &&
+       spec.scanline == scanline &&
+       spec.sample_format == sample_format ) return;
+
+  clear();
+  msaa = spec.msaa;
+  analytic = spec.analytic;
+  scanline = spec.scanline;
+  sample_format = spec.sample_format;
+}
+
+void TileCache::queue_row( const Key& key, int x1 ) {
+
+  Row row;
+  row.spec = view_spec;
+  row.key = key;
+  row.x1 = x1;
+  for ( int x = key.x; x < x1; ++x ) {
+    Key k = key; k.x = x;
+    pending.insert( k );
+  }
+
+  {
+    lock_guard<std::mutex> lock( mutex );
+    queue.push_back( row );
+  }
+  wake.notify_one();
+}
+
+void TileCache::unpend( const Row& row ) {
+  for ( int x = row.key.x; x < row.x1; ++x ) {
+    Key k = row.key; k.x = x;
+    pending.erase( k );
+  }
+}
+
+bool TileCache::add_rendered( bool copy ) {
+
+  vector<Rendered> finished;
+  {
+    lock_guard<std::mutex> lock( mutex );
+    finished.swap( rendered );
+  }
+
+  bool copied = false;
+  for ( size_t i = 0; i < finished.size(); ++i ) {
+
+    unpend( finished[i].row );
+    list<Tile>& row = finished[i].tiles;
+    for ( list<Tile>::iterator t = row.begin(); t != row.end(); ++t ) {
+
+      // copied before it is added, the budget may not hold the view
+      const Key& k = t->key;
+      if ( copy && k.tab == view.tab && k.level == view.level &&
+           k.sample_rate == view.sample_rate &&
+           k.x >= view_x0 && k.x < view_x1 &&
+           k.y >= view_y0 && k.y < view_y1 ) {
+        blit( &t->pixels[0], kCacheTileSize,
+              k.x * kCacheTileSize, k.y * kCacheTileSize,
+              kCacheTileSize, kCacheTileSize );
+        copied = true;
+      }
+      index[k] = t;
+    }
+    tiles.splice( tiles.begin(), row );
+  }
+
+  evict();
+  return copied;
+}
+
+bool TileCache::collect() {
+  return add_rendered( has_view );
+}
+
+bool TileCache::draw( const FrameSpec& spec, unsigned char* target ) {
+
+  // only scales by a zoom level followed by a translation
+  const Matrix3x3& m = spec.svg_2_screen;
+  if ( m(0,1) != 0 || m(1,0) != 0 ) return false;
+  if ( m(2,0) != 0 || m(2,1) != 0 || m(2,2) != 1 ) return false;
+  int n = level( m(0,0) );
+  double scale = level_scale( n );
+  if ( fabs( m(0,0) / scale - 1 ) > kLevelTolerance ||
+       fabs( m(1,1) / scale - 1 ) > kLevelTolerance ) return false;
+
+  // the tiles rendered since are added first, for the last view they
+  // were queued for
+  check_settings( spec );
+  add_rendered( false );
+
+  // translation in whole pixels and the tiles of the view
+  size_t tab = spec.tab, width = spec.width, height = spec.height;
+  int tx = (int) floor( m(0,2) + 0.5 );
+  int ty = (int) floor( m(1,2) + 0.5 );
+  Key key = { tab, n, 0, 0, spec.sample_rate };
+  int x0 = floor_div( -tx, kCacheTileSize );
+  int y0 = floor_div( -ty, kCacheTileSize );
+  int x1 = floor_div( -tx + (int) width  - 1, kCacheTileSize ) + 1;
+  int y1 = floor_div( -ty + (int) height - 1, kCacheTileSize ) + 1;
+
+  // the view moves the other way than the translation
+  bool same = has_view && view.tab == tab && view.level == n &&
+              view.sample_rate == spec.sample_rate;
+  if ( !same ) {
+    move_x = move_y = 0;
+  } else if ( tx != view_tx || ty != view_ty ) {
+    move_x = tx < view_tx ? 1 : (tx > view_tx ? -1 : 0);
+    move_y = ty < view_ty ? 1 : (ty > view_ty ? -1 : 0);
+  }
+
+  has_view = true;
+  view_spec = spec;
+  this->target = target; target_w = width; target_h = height;
+  view = key;
+  view_x0 = x0; view_y0 = y0; view_x1 = x1; view_y1 = y1;
+  view_tx = tx; view_ty = ty;
+
+  // rows queued for the views before are not needed any more (the one
+  // being rendered is still cached)
+  {
+    lock_guard<std::mutex> lock( mutex );
+    for ( size_t i = 0; i < queue.size(); ++i ) unpend( queue[i] );
+    queue.clear();
+  }
+
+  // Copy the cached tiles and queue the runs of missing ones in each row
+  // that are not being rendered already.
+  for ( int y = y0; y < y1; ++y ) {
+    for ( int x = x0; x < x1; ) {
+
+      key.x = x; key.y = y;
+      const Tile* tile = find( key );
+      if ( tile ) {
+        blit( &tile->pixels[0], kCacheTileSize,
+              x * kCacheTileSize, y * kCacheTileSize,
+              kCacheTileSize, kCacheTileSize );
+        ++x;
+        continue;
+      }
+      if ( pending.count( key ) ) {
+        ++x;
+        continue;
+      }
+
+      int end = x + 1;
+      for ( ; end < x1; ++end ) {
+        key.x = end;
+        if ( index.count( key ) || pending.count( key ) ) break;
+      }
+      key.x = x;
+      queue_row( key, end );
+      x = end;
+    }
+  }
+
+  return true;
+}
+
+bool TileCache::prefetch() {
+
+  if ( !has_view ) return false;
+
+  // Candidates are the column and row of tiles beyond the view on the
+  // side it moves to, or on all sides if it did not move.
+  bool moved = move_x || move_y;
+  vector<pair<int, int> > candidates;
+  for ( int y = view_y0; y < view_y1; ++y ) {
+    if ( move_x > 0 || !moved ) candidates.push_back( make_pair(view_x1, y) );
+    if ( move_x < 0 || !moved ) candidates.push_back( make_pair(view_x0 - 1, y) );
+  }
+  for ( int x = view_x0; x < view_x1; ++x ) {
+    if ( move_y > 0 || !moved ) candidates.push_back( make_pair(x, view_y1) );
+    if ( move_y < 0 || !moved ) candidates.push_back( make_pair(x, view_y0 - 1) );
+  }
+
+  // prefetching must not evict the tiles of the view or the ones it
+  // prefetched before
+  size_t view_tiles = (view_x1 - view_x0) * (view_y1 - view_y0);
+  if ( (view_tiles + candidates.size()) * kTileBytes > budget ) return false;
+
+  bool queued = false;
+  Key key = view;
+  for ( size_t i = 0; i < candidates.size(); ++i ) {
+    key.x = candidates[i].first; key.y = candidates[i].second;
+    if ( index.count( key ) || pending.count( key ) ) continue;
+
+    queue_row( key, key.x + 1 );
+    queued = true;
+  }
+
+  return queued;
+}
+
+void TileCache::run() {
+
+  unique_lock<std::mutex> lock( mutex );
+  while ( true ) {
+
+    wake.wait( lock, [this] { return stopping || !queue.empty(); } );
+    if ( stopping ) return;
+
+    current = queue.front();
+    queue.pop_front();
+    busy = true;
+    cancel = false;
+    lock.unlock();
+
+    Rendered row;
+    row.row = current;
+    if ( !render_row( row.row, row.tiles ) ) row.tiles.clear();
+
+    lock.lock();
+    rendered.push_back( Rendered() );
+    rendered.back().row = row.row;
+    rendered.back().tiles.swap( row.tiles );
+    busy = false;
+    done.notify_all();
+  }
+}
+
+bool TileCache::render_row( const Row& row, list<Tile>& tiles ) {
+
+  // the target is set before the sample rate, which clears it
+  const FrameSpec& spec = row.spec;
+  int x0 = row.key.x, x1 = row.x1, y = row.key.y;
+  size_t w = (x1 - x0) * kCacheTileSize;
+  row_pixels.resize( 4 * w * kCacheTileSize );
+  renderer.set_tex_sampler( spec.sampler );
+  renderer.set_msaa( spec.msaa );
+  renderer.set_analytic( spec.analytic );
+  renderer.set_scanline( spec.scanline );
+  renderer.set_sample_format( spec.sample_format );
+  renderer.set_render_target( &row_pixels[0], w, kCacheTileSize );
+  renderer.set_sample_rate( spec.sample_rate );
+
+  // draw the row shifted so it starts at the target's origin
+  Matrix3x3 m = Matrix3x3::identity();
+  m(0,0) = m(1,1) = level_scale( row.key.level );
+  m(0,2) = -x0 * kCacheTileSize;
+  m(1,2) = -y  * kCacheTileSize;
+  renderer.set_svg_2_screen( m );
+  renderer.draw_svg( *spec.svg );
+  if ( cancel ) return false;
+
+  // cut it into tiles
+  for ( int x = x0; x < x1; ++x ) {
+    tiles.push_back( Tile() );
+    Tile& tile = tiles.back();
+    tile.key = row.key; tile.key.x = x;
+    tile.pixels.resize( kTileBytes );
+    for ( int r = 0; r < kCacheTileSize; ++r ) {
+      memcpy( &tile.pixels[4 * r * kCacheTileSize],
+              &row_pixels[4 * (r * w + (x - x0) * kCacheTileSize)],
+              4 * kCacheTileSize );
+    }
+  }
+  return true;
+}
+
+void TileCache::blit( const unsigned char* src, size_t stride,
+                      int x, int y, int w, int h ) {
+
+  // clip the destination to the target
+  int dx0 = max( x + view_tx, 0 );
+  int dy0 = max( y + view_ty, 0 );
+  int dx1 = min( x + view_tx + w, (int) target_w );
+  int dy1 = min( y + view_ty + h, (int) target_h );
+  if ( dx0 >= dx1 ) return;
+
+  for ( int dy = dy0; dy < dy1; ++dy ) {
+    int sx = dx0 - view_tx - x, sy = dy - view_ty - y;
+    memcpy( &target[4 * (dy * target_w + dx0)],
+            &src[4 * (sy * stride + sx)], 4 * (dx1 - dx0) );
+  }
+}
+
+} // namespace CMU462
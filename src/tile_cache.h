@@ -0,0 +1,224 @@
+#ifndef CMU462_TILE_CACHE_H
+#define CMU462_TILE_CACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+
+#include "CMU462.h"
+#include "matrix3x3.h"
+#include "software_renderer.h"
+#include "background_renderer.h"
+#include "svg_bvh.h"
+
+namespace CMU462 {
+
+// Size (in pixels) of the square tiles of the cache
+static const int kCacheTileSize = 256;
+
+// Zoom levels per doubling of the scale
+static const int kZoomLevelSteps = 16;
+
+// Default memory budget (in bytes) of a tile cache
+static const size_t kTileCacheBudget = 64 << 20;
+
+/**
+ * LRU cache of resolved tiles of rendered documents. Views are cut into
+ * a grid of kCacheTileSize tiles anchored at the svg origin, one grid
+ * per zoom level, and tiles are keyed by tab, zoom level, grid position
+ * and sample rate. Zoom levels are the scales 2^(n / kZoomLevelSteps)
+ * (screen pixels per svg unit), so a view can only be drawn from the
+ * cache at one of those scales and its translation is rounded to whole
+ * pixels. Tiles are rendered (a row of them at a time) on a thread of
+ * its own, with a software renderer of its own that renders serially
+ * like the background renderer: drawing a view copies the cached tiles
+ * and queues the missing ones, which are copied into the view once
+ * rendered. The cache holds at most budget bytes of tiles, the least
+ * recently used ones are dropped first, and it empties itself when the
+ * renderer settings that change the output do. Documents are only read
+ * by the thread: their display lists must be compiled, and neither they
+ * nor their mipmaps may change while tiles of them are queued (clear or
+ * drop first).
+ */
+class TileCache {
+ public:
+
+  TileCache( size_t budget = kTileCacheBudget );
+
+  // stops the thread, cancelling the row being rendered
+  ~TileCache( );
+
+  // change the memory budget, dropping tiles over it
+  void set_budget( size_t budget );
+
+  inline size_t get_budget() const {
+    return budget;
+  }
+
+  // bytes held by tiles
+  inline size_t memory_usage() const {
+    return tiles.size() * kTileBytes;
+  }
+
+  // drop all tiles and queued rows, waiting for the row being rendered
+  void clear();
+
+  // Drop the tiles of tab that overlap bounds (in svg coordinates) and
+  // its queued rows, waiting for a row of tab being rendered.
+  void drop( size_t tab, const BBox2D& bounds );
+
+  // nearest zoom level of a scale and the scale of a level
+  static int level( double scale );
+  static double level_scale( int level );
+
+  // Draw the view of spec into target (spec.width x spec.height) from
+  // the cached tiles. spec.svg_2_screen must scale by a zoom level (up
+  // to rounding) and then translate. The missing tiles are left as they
+  // are in target and queued, in place of the tiles queued for views
+  // before; collect draws them once rendered. Returns false (and draws
+  // nothing) if spec is no such view.
+  bool draw( const FrameSpec& spec, unsigned char* target );
+
+  // Add the tiles rendered since the last call and copy those of the
+  // view drawn last into its target. Returns true if any was copied.
+  bool collect();
+
+  // Queue the missing tiles next to the view drawn last, in the
+  // direction it last moved (all around if it did not). Returns false
+  // if there are none.
+  bool prefetch();
+
+ private:
+
+  static const size_t kTileBytes = 4 * kCacheTileSize * kCacheTileSize;
+
+  struct Key {
+    size_t tab;
+    int level;
+    int x, y;
+    size_t sample_rate;
+
+    inline bool operator==( const Key& k ) const {
+      return tab == k.tab && level == k.level && x == k.x && y == k.y &&
+             sample_rate == k.sample_rate;
+    }
+  };
+
+  struct KeyHash {
+    inline size_t operator()( const Key& k ) const {
+      size_t h = k.tab;
+      h = h * 31 + (size_t) k.level;
+      h = h * 1000003 + (size_t) k.x;
+      h = h * 1000003 + (size_t) k.y;
+      return h * 31 + k.sample_rate;
+    }
+  };
+
+  // tiles in order of use, most recent first
+  struct Tile {
+    Key key;
+    std::vector<unsigned char> pixels;
+  };
+  std::list<Tile> tiles;
+  std::unordered_map<Key, std::list<Tile>::iterator, KeyHash> index;
+
+  // The tiles [key.x,x1) of row key.y of key's level and grid, drawn
+  // with the renderer settings of spec, and the tiles once rendered
+  // (none if the row was cancelled).
+  struct Row {
+    FrameSpec spec;
+    Key key;
+    int x1;
+  };
+  struct Rendered {
+    Row row;
+    std::list<Tile> tiles;
+  };
+
+  // bounds of the tiles of a row in svg coordinates, grown by a pixel
+  // for filtering
+  static BBox2D bounds( const Key& key, int x1 );
+
+  // cached tile (marked as used), or NULL
+  const Tile* find( const Key& key );
+
+  // drop tiles until the cache fits the budget
+  void evict();
+
+  // Add the tiles rendered since the last call, copying those of the
+  // view drawn last into its target if copy. Returns true if any was
+  // copied.
+  bool add_rendered( bool copy );
+
+  // queue a row, its tiles must not be pending
+  void queue_row( const Key& key, int x1 );
+
+  // forget that the tiles of row are pending
+  void unpend( const Row& row );
+
+  // empty the cache if the output settings of spec changed
+  void check_settings( const FrameSpec& spec );
+
+  // copy the w x h pixels of src (stride pixels per row) at (x,y) of
+  // the level to the target of the last view
+  void blit( const unsigned char* src, size_t stride,
+             int x, int y, int w, int h );
+
+  // thread main loop
+  void run();
+
+  // render row into tiles, false if it was cancelled
+  bool render_row( const Row& row, std::list<Tile>& tiles );
+
+  size_t budget;
+
+  // output settings the tiles were drawn with
+  bool msaa, analytic, scanline;
+  SampleFormat sample_format;
+
+  // Last view drawn: its spec and target, tile key (x, y unused), range
+  // of tiles [x0,x1)x[y0,y1), translation (whole pixels) and the
+  // direction of its last move (in the level, -1, 0 or 1).
+  bool has_view;
+  FrameSpec view_spec;
+  unsigned char* target;
+  size_t target_w, target_h;
+  Key view;
+  int view_x0, view_y0, view_x1, view_y1;
+  int view_tx, view_ty;
+  int move_x, move_y;
+
+  // tiles queued, being rendered or rendered and not collected yet
+  std::unordered_set<Key, KeyHash> pending;
+
+  // the thread's renderer and the scratch target of its rows
+  SoftwareRendererImp renderer;
+  std::vector<unsigned char> row_pixels;
+
+  // rows to render, in order, and rendered ones not collected yet
+  std::deque<Row> queue;
+  std::vector<Rendered> rendered;
+
+  // the row being rendered, valid while busy, and the flag that cancels
+  // it (cleared by the thread when it takes a row)
+  Row current;
+  bool busy;
+  std::atomic<bool> cancel;
+
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::thread thread;
+
+}; // class TileCache
+
+} // namespace CMU462
+
+#endif // CMU462_TILE_CACHE_H
@@ -1,130 +1,675 @@
+/* Ear clipper adapted from earcut (https://github.com/mapbox/earcut)
+ * Copyright (c) 2016, Mapbox
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
 #include "triangulation.h"
 
+#include <cmath>
+#include <algorithm>
 #include <vector>
 
 using namespace std;
 
-static const float EPSILON = 0.0000000001f;
-
 namespace CMU462 {
 
-bool inside(float Ax, float Ay,
-            float Bx, float By,
-            float Cx, float Cy,
-            float Px, float Py) {
+/**
+ * Ear clipper over a doubly linked ring of vertices. Holes are first
+ * joined to the outer contour by bridges, turning the polygon into a
+ * single (weakly simple) ring. Ears are then cut off one at a time. Only
+ * reflex vertices can lie inside an ear, and a vertex never turns reflex
+ * while ears are cut, so they are indexed once, sorted by their z-order
+ * (position along a Morton curve over the bounding box). An aligned
+ * square of the curve is a contiguous range of z-orders, so the test
+ * whether an ear is empty looks up the (at most four) squares covering
+ * the ear's bounding box by binary search, and refines crowded squares
+ * into their quadrants, dropping those outside the ear. It visits about
+ * the vertices near the ear instead of every vertex, O(n log n) overall
+ * instead of O(n^2). After an ear is cut, only its neighbours are tested
+ * again. Removing a vertex is O(1).
+ *
+ * Duplicate and collinear vertices are dropped when the clipper gets
+ * stuck, and it is retried once. A ring that still has no ear is not
+ * simple; the clipper then gives up and reports failure.
+ */
+class EarClipper {
+ public:
+
+  EarClipper( const vector<Vector2D>& points, vector<uint32_t>& indices )
+    : points ( points ), indices ( indices ), hashing ( false ), ok ( true ),
+      min_x ( 0 ), min_y ( 0 ), inv_size ( 0 ),
+      row_y0 ( 0 ), row_scale ( 0 ) { }
+
+  bool run( const vector<uint32_t>& holes );
+
+ private:
+
+  struct Node {
+    uint32_t i;            // index of the vertex
+    double x, y;
+    Node* prev; Node* next;
+    bool removed;          // cut off, or dropped as degenerate
+  };
+
+  // ring over points [start, end), in the given orientation
+  Node* make_ring( uint32_t start, uint32_t end, bool clockwise );
+
+  Node* insert_node( uint32_t i, Node* last );
+  static void remove_node( Node* p );
+
+  // drop duplicate and collinear vertices between start and end
+  static Node* filter_points( Node* start, Node* end = NULL );
+
+  void clip( Node* start, int pass );
+  bool is_ear( Node* ear ) const;
+  bool is_ear_hashed( Node* ear ) const;
+
+  // cell of a coordinate on the 2^15 x 2^15 grid of the curve
+  uint32_t cell( double v, double min_v ) const;
+
+  // whether one of the reflex vertices reflex[lo, hi), those of the
+  // square of 2^level cells at (sx, sy), blocks the ear abc
+  bool square_blocks( const Node* a, const Node* b, const Node* c,
+                      uint32_t sx, uint32_t sy, int level,
+                      size_t lo, size_t hi ) const;
+
+  // whether the square lies outside triangle abc
+  bool square_outside( const Node* a, const Node* b, const Node* c,
+                       uint32_t sx, uint32_t sy, int level ) const;
+
+  // index the reflex vertices of a ring
+  void index_reflex( Node* start );
+
+  // holes
+  Node* eliminate_holes( const vector<uint32_t>& holes, Node* outer );
+  Node* eliminate_hole( Node* hole, Node* outer );
+  Node* find_hole_bridge( Node* hole ) const;
+
+  // rows of the horizontal bands of the bounding box and the edges
+  // (p, p->next) of the outline crossing them, holes are added as they
+  // are bridged
+  size_t row( double y ) const;
+  void index_edge( Node* p );
+
+  // The node starting the edge indexed for p. Nodes dropped as duplicate
+  // or collinear have their edge merged into the one of the nearest
+  // preceding node left.
+  static inline Node* live( Node* p ) {
+    while ( p->removed ) p = p->prev;
+    return p;
+  }
+  Node* split_polygon( Node* a, Node* b );
+
+  static Node* leftmost( Node* start );
 
-  float ax, ay, bx, by, cx, cy, apx, apy, bpx, bpy, cpx, cpy;
-  float cCROSSap, bCROSScp, aCROSSbp;
+  // twice the signed area of triangle pqr, negative for convex corners
+  static inline double area( const Node* p, const Node* q, const Node* r ) {
+    return (q->y - p->y) * (r->x - q->x) - (q->x - p->x) * (r->y - q->y);
+  }
 
-  ax = Cx - Bx;  ay = Cy - By;
-  bx = Ax - Cx;  by = Ay - Cy;
-  cx = Bx - Ax;  cy = By - Ay;
-  apx= Px - Ax;  apy= Py - Ay;
-  bpx= Px - Bx;  bpy= Py - By;
-  cpx= Px - Cx;  cpy= Py - Cy;
+  static inline bool equals( const Node* p, const Node* q ) {
+    return p->x == q->x && p->y == q->y;
+  }
 
-  aCROSSbp = ax*bpy - ay*bpx;
-  cCROSSap = cx*apy - cy*apx;
-  bCROSScp = bx*cpy - by*cpx;
+  static inline bool point_in_triangle( double ax, double ay,
+                                        double bx, double by,
+                                        double cx, double cy,
+                                        double px, double py ) {
+    return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+           (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+           (bx - px) * (cy - py) >= (cx - px) * (by - py);
+  }
 
-  return ((aCROSSbp >= 0.0f) && (bCROSScp >= 0.0f) && (cCROSSap >= 0.0f));
-};
+  // p lies in triangle abc and is not a copy of a (as left by bridges)
+  static inline bool in_ear( const Node* a, const Node* b, const Node* c,
+                             const Node* p ) {
+    return !(a->x == p->x && a->y == p->y) &&
+           point_in_triangle( a->x, a->y, b->x, b->y, c->x, c->y,
+                              p->x, p->y );
+  }
 
+  static bool locally_inside( const Node* a, const Node* b );
+  static bool sector_contains_sector( const Node* m, const Node* p );
 
-float area(const vector<Vector2D> &contour) {
+  const vector<Vector2D>& points;
+  vector<uint32_t>& indices;
 
-  int n = contour.size();
+  // node storage, reserved up front so that nodes never move
+  vector<Node> nodes;
 
-  float a = 0.0f;
-  for(int p=n-1,q=0; q<n; p=q++) {
-    a += contour[p].x * contour[q].y - contour[q].x * contour[p].y;
+  // reflex vertices by z-order, removed ones are skipped
+  vector<pair<uint32_t, Node*> > reflex;
+
+  bool hashing;
+  bool ok;
+  double min_x, min_y, inv_size;
+
+  vector<vector<Node*> > rows;
+  double row_y0, row_scale;
+
+}; // class EarClipper
+
+bool EarClipper::run( const vector<uint32_t>& holes ) {
+
+  size_t n = points.size();
+  uint32_t outer_end = holes.empty() ? n : holes[0];
+  if ( outer_end < 3 ) return true;
+
+  for (size_t i = 0; i < n; i++) {
+    if ( !isfinite(points[i].x) || !isfinite(points[i].y) ) return false;
   }
 
-  return a * 0.5f;
+  // every bridge to a hole duplicates two vertices
+  nodes.reserve( n + 2 * holes.size() );
+
+  Node* outer = make_ring( 0, outer_end, true );
+  if ( !outer || outer->next == outer->prev ) return true;
+
+  if ( !holes.empty() ) outer = eliminate_holes( holes, outer );
+
+  // hash vertices only when there are enough of them to pay off
+  if ( n > 80 ) {
+    double max_x = min_x = points[0].x;
+    double max_y = min_y = points[0].y;
+    for (uint32_t i = 1; i < outer_end; i++) {
+      min_x = min(min_x, points[i].x); max_x = max(max_x, points[i].x);
+      min_y = min(min_y, points[i].y); max_y = max(max_y, points[i].y);
+    }
+    double size = max(max_x - min_x, max_y - min_y);
+    inv_size = size != 0 ? 32767 / size : 0;
+    hashing = true;
+  }
+
+  clip( outer, 0 );
+  return ok;
+}
+
+EarClipper::Node* EarClipper::make_ring( uint32_t start, uint32_t end,
+                                         bool clockwise ) {
+
+  double sum = 0;
+  for (uint32_t i = start, j = end - 1; i < end; j = i++) {
+    sum += (points[j].x - points[i].x) * (points[i].y + points[j].y);
+  }
+
+  Node* last = NULL;
+  if ( clockwise == (sum > 0) ) {
+    for (uint32_t i = start; i < end; i++) last = insert_node( i, last );
+  } else {
+    for (uint32_t i = end; i-- > start; ) last = insert_node( i, last );
+  }
+
+  // a closing point repeating the first one is dropped
+  if ( last && equals( last, last->next ) ) {
+    remove_node( last );
+    last = last->next;
+  }
+  return last;
 }
 
-bool snip(const vector<Vector2D>& contour,int u,int v,int w,int n,int *V ) {
+EarClipper::Node* EarClipper::insert_node( uint32_t i, Node* last ) {
 
-  int p;
-  float Ax, Ay, Bx, By, Cx, Cy, Px, Py;
+  Node node = { i, points[i].x, points[i].y, NULL, NULL, false };
+  nodes.push_back( node );
+  Node* p = &nodes.back();
 
-  Ax = contour[V[u]].x;
-  Ay = contour[V[u]].y;
+  if ( !last ) {
+    p->prev = p;
+    p->next = p;
+  } else {
+    p->next = last->next;
+    p->prev = last;
+    last->next->prev = p;
+    last->next = p;
+  }
+  return p;
+}
+
+void EarClipper::remove_node( Node* p ) {
 
-  Bx = contour[V[v]].x;
-  By = contour[V[v]].y;
+  p->next->prev = p->prev;
+  p->prev->next = p->next;
+  p->removed = true;
+}
 
-  Cx = contour[V[w]].x;
-  Cy = contour[V[w]].y;
+EarClipper::Node* EarClipper::filter_points( Node* start, Node* end ) {
+
+  if ( !start ) return start;
+  if ( !end ) end = start;
+
+  Node* p = start;
+  bool again;
+  do {
+    again = false;
+    if ( equals( p, p->next ) || area( p->prev, p, p->next ) == 0 ) {
+      remove_node( p );
+      p = end = p->prev;
+      if ( p == p->next ) break;
+      again = true;
+    } else {
+      p = p->next;
+    }
+  } while ( again || p != end );
 
-  if ( EPSILON > (((Bx-Ax)*(Cy-Ay)) - ((By-Ay)*(Cx-Ax))) ) return false;
+  return end;
+}
 
-  for ( p = 0; p < n; p++ ) {
-    if( (p == u) || (p == v) || (p == w) ) continue;
-    Px = contour[V[p]].x;
-    Py = contour[V[p]].y;
-    if (inside(Ax,Ay,Bx,By,Cx,Cy,Px,Py)) return false;
+void EarClipper::clip( Node* start, int pass ) {
+
+  if ( !start ) return;
+  if ( !pass && hashing ) index_reflex( start );
+
+  // Every vertex is tested once, in order, and then again each time a
+  // neighbour is cut off. No other vertex can become an ear then: one
+  // blocked by a neighbour that turned convex is still blocked, as a
+  // triangle containing any vertex contains a reflex one.
+  vector<Node*> pending;
+  Node* p = start;
+  do {
+    pending.push_back( p );
+    p = p->next;
+  } while ( p != start );
+
+  size_t remaining = pending.size();
+  for (size_t i = 0; i < pending.size() && remaining > 2; i++) {
+
+    Node* ear = pending[i];
+    if ( ear->removed ) continue;
+    if ( !(hashing ? is_ear_hashed( ear ) : is_ear( ear )) ) continue;
+
+    Node* prev = ear->prev;
+    Node* next = ear->next;
+    indices.push_back( prev->i );
+    indices.push_back( ear->i );
+    indices.push_back( next->i );
+    remove_node( ear );
+    remaining--;
+
+    pending.push_back( prev );
+    pending.push_back( next );
+    start = next;
   }
 
+  // no ear left
+  if ( remaining > 2 ) {
+    if ( !pass ) {
+      clip( filter_points( start ), 1 );
+    } else {
+      ok = false;
+    }
+  }
+}
+
+bool EarClipper::is_ear( Node* ear ) const {
+
+  const Node* a = ear->prev;
+  const Node* b = ear;
+  const Node* c = ear->next;
+
+  // reflex, can't be an ear
+  if ( area( a, b, c ) >= 0 ) return false;
+
+  double x0 = min(a->x, min(b->x, c->x)), x1 = max(a->x, max(b->x, c->x));
+  double y0 = min(a->y, min(b->y, c->y)), y1 = max(a->y, max(b->y, c->y));
+
+  // no other vertex may lie in the ear
+  for (const Node* p = c->next; p != a; p = p->next) {
+    if ( p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 &&
+         in_ear( a, b, c, p ) && area( p->prev, p, p->next ) >= 0 ) {
+      return false;
+    }
+  }
   return true;
 }
 
-void triangulate(const Polygon& polygon, vector<Vector2D>& triangles) {
-  
-  const vector<Vector2D>& contour = polygon.points;
+// interleave the bits of 16 bit x and y
+static inline uint32_t z_order( uint32_t x, uint32_t y ) {
 
-  // allocate and initialize list of vertices in polygon
-  int n = contour.size();
-  if ( n < 3 ) return;
+  x = (x | (x << 8)) & 0x00FF00FF;
+  x = (x | (x << 4)) & 0x0F0F0F0F;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
 
-  vector<int> V(n);
+  y = (y | (y << 8)) & 0x00FF00FF;
+  y = (y | (y << 4)) & 0x0F0F0F0F;
+  y = (y | (y << 2)) & 0x33333333;
+  y = (y | (y << 1)) & 0x55555555;
 
-  // we want a counter-clockwise polygon in V
-  if ( 0.0f < area(contour) ) {
-    for (int v=0; v<n; v++) V[v] = v;
-  } else {
-    for(int v=0; v<n; v++) V[v] = (n-1)-v;
+  return x | (y << 1);
+}
+
+bool EarClipper::is_ear_hashed( Node* ear ) const {
+
+  const Node* a = ear->prev;
+  const Node* b = ear;
+  const Node* c = ear->next;
+
+  if ( area( a, b, c ) >= 0 ) return false;
+
+  double x0 = min(a->x, min(b->x, c->x)), x1 = max(a->x, max(b->x, c->x));
+  double y0 = min(a->y, min(b->y, c->y)), y1 = max(a->y, max(b->y, c->y));
+
+  // the squares of the smallest size at which the bounding box spans at
+  // most two of them per axis
+  uint32_t cx0 = cell( x0, min_x ), cx1 = cell( x1, min_x );
+  uint32_t cy0 = cell( y0, min_y ), cy1 = cell( y1, min_y );
+  int level = 0;
+  while ( (cx1 >> level) - (cx0 >> level) > 1 ||
+          (cy1 >> level) - (cy0 >> level) > 1 ) level++;
+
+  for (uint32_t sy = cy0 >> level; sy <= cy1 >> level; sy++) {
+    for (uint32_t sx = cx0 >> level; sx <= cx1 >> level; sx++) {
+      uint32_t z0 = z_order( sx << level, sy << level );
+      uint32_t z1 = z0 + (1u << (2 * level));
+      size_t lo = lower_bound( reflex.begin(), reflex.end(),
+                               make_pair( z0, (Node*) NULL ) ) - reflex.begin();
+      size_t hi = lower_bound( reflex.begin() + lo, reflex.end(),
+                               make_pair( z1, (Node*) NULL ) ) - reflex.begin();
+      if ( square_blocks( a, b, c, sx, sy, level, lo, hi ) ) return false;
+    }
   }
-  
-  int nv = n;
 
-  // remove nv-2 Vertices, creating 1 triangle every time
-  int count = 2*nv;   // error detection 
+  return true;
+}
 
-  for(int m = 0, v = nv - 1; nv > 2;) {
+bool EarClipper::square_blocks( const Node* a, const Node* b, const Node* c,
+                                uint32_t sx, uint32_t sy, int level,
+                                size_t lo, size_t hi ) const {
+
+  if ( lo == hi ) return false;
+
+  // refine crowded squares into their quadrants, each a quarter of the
+  // square's range
+  if ( hi - lo > 8 && level > 0 ) {
+    if ( square_outside( a, b, c, sx, sy, level ) ) return false;
+
+    level--;
+    for (int k = 0; k < 4; k++) {
+      uint32_t qx = 2 * sx + (k & 1), qy = 2 * sy + (k >> 1);
+      uint32_t z1 = z_order( qx << level, qy << level ) + (1u << (2 * level));
+      size_t mid = lower_bound( reflex.begin() + lo, reflex.begin() + hi,
+                                make_pair( z1, (Node*) NULL ) ) - reflex.begin();
+      if ( square_blocks( a, b, c, qx, qy, level, lo, mid ) ) return true;
+      lo = mid;
+    }
+    return false;
+  }
 
-    // if we loop, it is probably a non-simple polygon
-    if (0 >= (count--)) {
-      // Triangulate: ERROR - probable bad polygon!
-      return;
+  double x0 = min(a->x, min(b->x, c->x)), x1 = max(a->x, max(b->x, c->x));
+  double y0 = min(a->y, min(b->y, c->y)), y1 = max(a->y, max(b->y, c->y));
+
+  for (size_t i = lo; i < hi; i++) {
+    const Node* p = reflex[i].second;
+    if ( p->removed || p == a || p == c ) continue;
+    if ( p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 &&
+         in_ear( a, b, c, p ) && area( p->prev, p, p->next ) >= 0 ) {
+      return true;
     }
+  }
+  return false;
+}
 
-    // three consecutive vertices in current polygon, <u,v,w>
-    int u = v     ; if (nv <= u) u = 0;      // prev
-    v = u + 1     ; if (nv <= v) v = 0;      // new v   
-    int w = v + 1 ; if (nv <= w) w = 0;      // next    
+bool EarClipper::square_outside( const Node* a, const Node* b, const Node* c,
+                                 uint32_t sx, uint32_t sy, int level ) const {
+
+  // the outer cells also hold the points clamped into them
+  uint32_t last = ((sx + 1) << level) - 1, last_y = ((sy + 1) << level) - 1;
+  if ( sx == 0 || sy == 0 || last >= 32767 || last_y >= 32767 ) return false;
+
+  // square bounds, grown by a cell against rounding
+  double cell_size = 1 / inv_size;
+  double x0 = min_x + (sx << level) * cell_size - cell_size;
+  double y0 = min_y + (sy << level) * cell_size - cell_size;
+  double x1 = min_x + (last + 1) * cell_size + cell_size;
+  double y1 = min_y + (last_y + 1) * cell_size + cell_size;
+  double xs[4] = { x0, x1, x0, x1 };
+  double ys[4] = { y0, y0, y1, y1 };
+
+  // an edge of the triangle with all corners on its outer side
+  const Node* v[3] = { c, a, b };
+  for (int e = 0; e < 3; e++) {
+    const Node* p = v[e];
+    const Node* q = v[(e + 1) % 3];
+    int out = 0;
+    for (int k = 0; k < 4; k++) {
+      double px = xs[k], py = ys[k];
+      if ( (p->x - px) * (q->y - py) < (q->x - px) * (p->y - py) ) out++;
+    }
+    if ( out == 4 ) return true;
+  }
+  return false;
+}
+
+uint32_t EarClipper::cell( double v, double min_v ) const {
 
-    if ( snip(contour,u,v,w,nv,&V[0]) ) {
+  double c = (v - min_v) * inv_size;
+  return c <= 0 ? 0 : c >= 32767 ? 32767 : (uint32_t) c;
+}
+
+void EarClipper::index_reflex( Node* start ) {
 
-      int a,b,c,s,t;
+  reflex.clear();
+  Node* p = start;
+  do {
+    if ( area( p->prev, p, p->next ) >= 0 ) {
+      reflex.push_back( make_pair( z_order( cell( p->x, min_x ),
+                                            cell( p->y, min_y ) ), p ) );
+    }
+    p = p->next;
+  } while ( p != start );
 
-      // true names of the vertices
-      a = V[u]; b = V[v]; c = V[w];
+  sort( reflex.begin(), reflex.end() );
+}
 
-      // output Triangle
-      triangles.push_back( contour[a] );
-      triangles.push_back( contour[b] );
-      triangles.push_back( contour[c] );
+// orders holes by their leftmost vertex
+static bool left_of( const pair<double, size_t>& a,
+                     const pair<double, size_t>& b ) {
+  return a.first < b.first;
+}
+
+EarClipper::Node* EarClipper::eliminate_holes( const vector<uint32_t>& holes,
+                                               Node* outer ) {
+
+  vector<Node*> rings;
+  vector<pair<double, size_t> > order;
+  for (size_t i = 0; i < holes.size(); i++) {
+    uint32_t start = holes[i];
+    uint32_t end = i + 1 < holes.size() ? holes[i + 1] : points.size();
+    if ( end - start < 3 ) continue;
+
+    Node* ring = make_ring( start, end, false );
+    if ( !ring || ring == ring->next ) continue;
+    ring = leftmost( ring );
+    order.push_back( make_pair( ring->x, rings.size() ) );
+    rings.push_back( ring );
+  }
+
+  // about sqrt(n) rows of sqrt(n) edges each
+  double y0 = points[0].y, y1 = points[0].y;
+  for (size_t i = 1; i < points.size(); i++) {
+    y0 = min(y0, points[i].y);
+    y1 = max(y1, points[i].y);
+  }
+  rows.resize( max( 1, (int) sqrt( (double) points.size() ) ) );
+  row_y0 = y0;
+  row_scale = y1 > y0 ? rows.size() / (y1 - y0) : 0;
+
+  Node* p = outer;
+  do {
+    index_edge( p );
+    p = p->next;
+  } while ( p != outer );
+
+  // bridge holes from left to right, so that later bridges can't cross
+  // earlier ones
+  stable_sort( order.begin(), order.end(), left_of );
+  for (size_t i = 0; i < order.size(); i++) {
+    outer = eliminate_hole( rings[order[i].second], outer );
+  }
+  return outer;
+}
 
-      m++;
+EarClipper::Node* EarClipper::eliminate_hole( Node* hole, Node* outer ) {
 
-      // remove v from remaining polygon
-      for( s = v, t = v + 1; t < nv; s++, t++) V[s] = V[t]; nv--;
+  Node* bridge = find_hole_bridge( hole );
+  if ( !bridge ) return outer;
 
-      // resest error detection counter
-      count = 2 * nv;
+  Node* bridge_reverse = split_polygon( bridge, hole );
+
+  // index the edges of the hole and the bridge, and the one following it
+  // (now starting at a copy of the bridge's end)
+  for (Node* p = hole; p != bridge_reverse; p = p->next) index_edge( p );
+  index_edge( bridge );
+  index_edge( bridge_reverse );
+  index_edge( bridge_reverse->next );
+
+  // filter the collinear points around the cuts
+  filter_points( bridge_reverse, bridge_reverse->next );
+  return filter_points( bridge, bridge->next );
+}
+
+size_t EarClipper::row( double y ) const {
+
+  double r = (y - row_y0) * row_scale;
+  return r <= 0 ? 0 : min( (size_t) r, rows.size() - 1 );
+}
+
+void EarClipper::index_edge( Node* p ) {
+
+  size_t r0 = row( min(p->y, p->next->y) );
+  size_t r1 = row( max(p->y, p->next->y) );
+  for (size_t r = r0; r <= r1; r++) rows[r].push_back( p );
+}
+
+EarClipper::Node* EarClipper::find_hole_bridge( Node* hole ) const {
+
+  double hx = hole->x, hy = hole->y;
+  double qx = -INF_D;
+  Node* m = NULL;
+
+  // find the segment left of the hole closest to it on its horizontal,
+  // with m the end point of the segment with the smaller x
+  const vector<Node*>& edges = rows[row( hy )];
+  for (size_t i = 0; i < edges.size(); i++) {
+    Node* p = live( edges[i] );
+    if ( hy <= p->y && hy >= p->next->y && p->next->y != p->y ) {
+      double x = p->x + (hy - p->y) * (p->next->x - p->x) /
+                                      (p->next->y - p->y);
+      if ( x <= hx && x > qx ) {
+        qx = x;
+        m = p->x < p->next->x ? p : p->next;
+        if ( x == hx ) return m; // the hole touches the outline
+      }
     }
   }
+
+  if ( !m ) return NULL;
+
+  // If vertices lie in the triangle of the hole, the intersection and m,
+  // connect to the one with the smallest angle to the horizontal instead,
+  // a reflex vertex that m can't see past.
+  double mx = m->x, my = m->y;
+  double tan_min = INF_D;
+
+  size_t r1 = row( max(hy, my) );
+  for (size_t r = row( min(hy, my) ); r <= r1; r++) {
+    for (size_t i = 0; i < rows[r].size(); i++) {
+      Node* p = live( rows[r][i] );
+      if ( hx >= p->x && p->x >= mx && hx != p->x &&
+           point_in_triangle( hy < my ? hx : qx, hy, mx, my,
+                              hy < my ? qx : hx, hy, p->x, p->y ) ) {
+
+        double tan = fabs(hy - p->y) / (hx - p->x);
+        if ( locally_inside( p, hole ) &&
+             (tan < tan_min || (tan == tan_min && (p->x > m->x ||
+              (p->x == m->x && sector_contains_sector( m, p ))))) ) {
+          m = p;
+          tan_min = tan;
+        }
+      }
+    }
+  }
+
+  return m;
+}
+
+EarClipper::Node* EarClipper::split_polygon( Node* a, Node* b ) {
+
+  // connect a and b with a two way bridge, splitting the ring in two
+  // (or joining two rings in one), and return the copy of b
+  Node* a2 = insert_node( a->i, NULL );
+  Node* b2 = insert_node( b->i, NULL );
+  Node* an = a->next;
+  Node* bp = b->prev;
+
+  a->next = b;
+  b->prev = a;
+
+  a2->next = an;
+  an->prev = a2;
+
+  b2->next = a2;
+  a2->prev = b2;
+
+  bp->next = b2;
+  b2->prev = bp;
+
+  return b2;
+}
+
+EarClipper::Node* EarClipper::leftmost( Node* start ) {
+
+  Node* p = start;
+  Node* left = start;
+  do {
+    if ( p->x < left->x || (p->x == left->x && p->y < left->y) ) left = p;
+    p = p->next;
+  } while ( p != start );
+  return left;
+}
+
+bool EarClipper::locally_inside( const Node* a, const Node* b ) {
+
+  return area( a->prev, a, a->next ) < 0 ?
+         area( a, b, a->next ) >= 0 && area( a, a->prev, b ) >= 0 :
+         area( a, b, a->prev ) < 0 || area( a, a->next, b ) < 0;
+}
+
+bool EarClipper::sector_contains_sector( const Node* m, const Node* p ) {
+
+  return area( m->prev, m, p->prev ) < 0 && area( p->next, m, m->next ) < 0;
+}
+
+bool triangulate( const vector<Vector2D>& points,
+                  const vector<uint32_t>& holes, vector<uint32_t>& indices ) {
+
+  EarClipper clipper( points, indices );
+  return clipper.run( holes );
+}
+
+bool triangulate(const Polygon& polygon, vector<uint32_t>& indices) {
+
+  return triangulate( polygon.points, vector<uint32_t>(), indices );
+}
+
+void triangulate(const Polygon& polygon, vector<Vector2D>& triangles) {
+
+  vector<uint32_t> indices;
+  triangulate(polygon, indices);
+  for (size_t i = 0; i < indices.size(); i++) {
+    triangles.push_back( polygon.points[indices[i]] );
+  }
 }
 
 } // namespace CMU462
@@ -1,6 +1,8 @@
 #ifndef CMU462_TRIANGULATION_H
 #define CMU462_TRIANGULATION_H
 
+#include <stdint.h>
+
 #include "svg.h"
 
 namespace CMU462 {
@@ -8,7 +10,19 @@ namespace CMU462 {
 // triangulates a polygon and save the result as a triangle list
 void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles );
 
+// triangulates a polygon and save the result as indices into its points,
+// three per triangle. Returns false if the outline is not simple, the
+// triangles then cover only part of it.
+bool triangulate(const Polygon& polygon, std::vector<uint32_t>& indices );
+
+// Triangulates a polygon with holes. The outline comes first in points,
+// followed by the outline of every hole, holes holds the index of the
+// first point of each hole. Duplicate and collinear points are skipped,
+// otherwise as above.
+bool triangulate( const std::vector<Vector2D>& points,
+                  const std::vector<uint32_t>& holes,
+                  std::vector<uint32_t>& indices );
+
 } // namespace CMU462
 
 #endif // CMU462_TRIANGULATION_H
-